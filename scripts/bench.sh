@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+
+# usage: scripts/bench.sh [file.fth]...
+# runs each benchmark once per configuration and prints the wall time,
+# configurations can be overridden with CONFIGS="--engine=call;-O0"
+
+IFS=';' read -ra configs <<< "${CONFIGS:---engine=call;--engine=threaded;--engine=tos;--jit}"
+TIMEFORMAT=%R
+
+printf "%-20s" "benchmark"
+for c in "${configs[@]}"; do
+    printf "%22s" "$c"
+done
+printf "\n"
+
+for var in "$@"; do
+    printf "%-20s" "$(basename $var)"
+    for c in "${configs[@]}"; do
+        t=$( { time ./reinforth $c $var > /dev/null; } 2>&1 )
+        printf "%22s" "${t}s"
+    done
+    printf "\n"
+done
@@ -1,5 +1,13 @@
 #!/bin/bash
 
+if [[ -n $ENGINE ]] ; then
+    echo -DDEFAULT_ENGINE=ENGINE_${ENGINE^^}
+fi
+
+if [[ -n $CELL_BITS ]] ; then
+    echo -DCELL_BITS=$CELL_BITS
+fi
+
 if [[ $RELEASE -eq 1 ]] ; then
     echo -O2 -flto
     exit
@@ -0,0 +1,18 @@
+#!/usr/bin/env bash
+
+# usage: scripts/codesize.sh [file.fth]...
+# compares the size of the colon definitions of each script as cells and in
+# the compact format
+
+printf "%-20s%8s%14s%14s%8s\n" "script" "words" "cells" "compact" "ratio"
+for var in "$@"; do
+    line=$( { cat $var; echo; echo .codesize; } | ./reinforth --compact |
+        grep '^compact ')
+    read -r _ words _ cells _ _ _ compact _ <<< "$line"
+    words=${words%,}
+    cells=${cells%,}
+    ratio=$(awk "BEGIN { if ($compact > 0)
+        printf \"%.1fx\", $cells / $compact }")
+    printf "%-20s%8s%14s%14s%8s\n" "$(basename $var)" "$words" "${cells}B" \
+        "${compact}B" "$ratio"
+done
@@ -0,0 +1,166 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Build step making src/keytab.h, the perfect hash table of keyword.c.
+//
+//     genkeys src/syntax.c src/opcode.c > src/keytab.h
+//
+// reads the names of syntax_name and op_vec from the sources given, skips
+// those a token can't spell, and looks for the smallest table and a
+// multiplier putting the hash of every name in a slot of its own.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/crc32.h"
+
+#define MAXKEYS 1024
+#define MAXBITS 16
+#define TRIES (1 << 20)
+
+struct key {
+    char name[64];
+    char sym[64];
+    const char *kind;
+    uint32_t hash;
+};
+
+static struct key keys[MAXKEYS];
+static int nkeys;
+
+static void add(const char *name, const char *sym, const char *kind)
+{
+    for (int i = 0; i < nkeys; i++) {
+        // syntax words are read first and win over builtins
+        if (strcmp(keys[i].name, name) == 0)
+            return;
+    }
+    if (nkeys == MAXKEYS) {
+        fprintf(stderr, "genkeys: too many keywords\n");
+        exit(EXIT_FAILURE);
+    }
+    struct key *k = &keys[nkeys++];
+    snprintf(k->name, sizeof(k->name), "%s", name);
+    snprintf(k->sym, sizeof(k->sym), "%s", sym);
+    k->kind = kind;
+    // as word_hash in keyword.c
+    k->hash = crc32c(0, name, strlen(name));
+}
+
+// the entries [SYM] = "name" of the array declared as *table[ in line and
+// the lines after it, up to its closing brace
+static void scan(FILE *f, char *line, size_t size, const char *kind)
+{
+    do {
+        char *p = line;
+        char *s, *q;
+        while ((s = strchr(p, '[')) != NULL && (q = strchr(s, ']')) != NULL) {
+            p = q + 1;
+            char *n = strstr(p, "= \"");
+            char *e = n != NULL ? strchr(n + 3, '"') : NULL;
+            if (n == NULL || e == NULL || n != p + 1)
+                continue;
+            *q = *e = '\0';
+            // names with escapes hold whitespace, no token matches them
+            if (strchr(n + 3, '\\') == NULL && strchr(n + 3, ' ') == NULL)
+                add(n + 3, s + 1, kind);
+            p = e + 1;
+        }
+        if (strstr(line, "};") != NULL)
+            return;
+    } while (fgets(line, size, f) != NULL);
+}
+
+static void read_source(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strstr(line, "*syntax_name[") != NULL)
+            scan(f, strchr(line, '{'), sizeof(line), "KEY_SYNTAX");
+        else if (strstr(line, "*op_vec[") != NULL)
+            scan(f, strchr(line, '{'), sizeof(line), "KEY_OP");
+    }
+    fclose(f);
+}
+
+static int slot(uint32_t h, uint32_t mult, int bits)
+{
+    return (uint32_t)(h * mult) >> (32 - bits);
+}
+
+// a multiplier for a table of 1 << bits slots, 0 if none was found
+static uint32_t search(int bits)
+{
+    static uint32_t used[1 << MAXBITS];
+    uint32_t x = 0x9e3779b9;
+    for (uint32_t t = 1; t <= TRIES; t++) {
+        // xorshift, odd multipliers only
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        uint32_t mult = x | 1;
+        int i;
+        for (i = 0; i < nkeys; i++) {
+            int s = slot(keys[i].hash, mult, bits);
+            if (used[s] == t)
+                break;
+            used[s] = t;
+        }
+        if (i == nkeys)
+            return mult;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        read_source(argv[i]);
+    int bits = 1;
+    while ((1 << bits) < nkeys)
+        bits++;
+    uint32_t mult = 0;
+    for (; bits <= MAXBITS && (mult = search(bits)) == 0; bits++)
+        ;
+    if (nkeys == 0 || mult == 0) {
+        fprintf(stderr, "genkeys: no perfect hash for %d keywords\n", nkeys);
+        return EXIT_FAILURE;
+    }
+    printf("// generated by scripts/genkeys.c from op_vec and syntax_name, "
+           "do not edit\n\n");
+    printf("#define KEY_MULT 0x%08xu\n", mult);
+    printf("#define KEY_BITS %d\n\n", bits);
+    printf("static const struct keyword keywords[%d] = {\n", nkeys);
+    for (int i = 0; i < nkeys; i++)
+        printf("    {\"%s\", %d, %s, %s},\n", keys[i].name,
+               (int)strlen(keys[i].name), keys[i].kind, keys[i].sym);
+    printf("};\n\n");
+    printf("// one more than the index in keywords of the name in each "
+           "slot\n");
+    printf("static const uint16_t keyslot[1 << KEY_BITS] = {\n");
+    for (int i = 0; i < nkeys; i++)
+        printf("    [%d] = %d,\n", slot(keys[i].hash, mult, bits), i + 1);
+    printf("};\n");
+    return 0;
+}
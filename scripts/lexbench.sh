@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+
+# usage: scripts/lexbench.sh [megabytes]
+# generates a source of colon definitions and comments and prints how fast
+# it is loaded, from a file and from a pipe, configurations can be
+# overridden with CONFIGS="-O0;--engine=call"
+
+IFS=';' read -ra configs <<< "${CONFIGS:--O0;--engine=tos}"
+mb=${1:-16}
+src=$(mktemp --suffix=.fth)
+trap 'rm -f $src' EXIT
+
+awk -v bytes=$((mb * 1024 * 1024)) 'BEGIN {
+    for (i = 0; n < bytes; i++) {
+        line = sprintf("( word %d squares and adds ) : w%d dup * %d + ;\n", \
+            i, i, i)
+        printf "%s", line
+        n += length(line)
+    }
+}' > $src
+size=$(stat -c %s $src)
+
+TIMEFORMAT=%R
+printf "%-20s%14s%14s\n" "config" "file" "pipe"
+for c in "${configs[@]}"; do
+    f=$( { time ./reinforth $c $src > /dev/null; } 2>&1 )
+    p=$( { time ./reinforth $c < $src > /dev/null; } 2>&1 )
+    printf "%-20s%14s%14s\n" "${c:-default}" \
+        "$(awk "BEGIN { printf \"%.1f MB/s\", $size / 1048576 / $f }")" \
+        "$(awk "BEGIN { printf \"%.1f MB/s\", $size / 1048576 / $p }")"
+done
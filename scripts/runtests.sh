@@ -1,9 +1,18 @@
 #!/usr/bin/env bash
 
 for var in "$@"; do
-    ./reinforth $var
+    # scripts in tests/errors must stop on the error their first line names
+    if [[ $var == tests/errors/* ]]; then
+        msg=$(head -n 1 $var | sed 's/^( \(.*\) )$/\1/')
+        out=$(./reinforth $FLAGS $var 2>&1)
+        if [ $? -eq 0 ] || [[ $out != *"$msg"* ]]; then
+            echo "$var: expected \"$msg\", got \"$out\""
+            exit 255
+        fi
+        continue
+    fi
+    ./reinforth $FLAGS $var
     if [ $? -ne 0 ]; then
         exit 255
     fi
 done
-
@@ -0,0 +1,156 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "casetab.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "insn.h"
+#include "opcode.h"
+
+// shorter chains are left as tests
+#define CASE_MIN 4
+
+// Each `N of` compiles to the test
+//
+//     push N  over  eqjz next  drop
+//
+// and a chain of them, each test jumping to the next when it fails, is
+// replaced by a table taking the top of the stack to the drop of its test,
+// with a jump to what follows the last test for the values it lacks.
+struct entry {
+    data value;
+    int order;
+    int target;
+};
+
+static bool stops(enum opcode op)
+{
+    return op == OP_JMP || op == OP_EXIT || op == OP_TAILCALL;
+}
+
+// the drop of the test starting at i, or -1 if there is none
+static int test_at(struct insnlist *l, int *refs, int i)
+{
+    if (i >= l->size || l->buf[i].dead || l->buf[i].op != OP_PUSH)
+        return -1;
+    int o = insn_next(l, i);
+    int e = insn_next(l, o);
+    int d = insn_next(l, e);
+    if (d >= l->size || l->buf[o].op != OP_OVER || l->buf[e].op != OP_EQJZ ||
+        l->buf[d].op != OP_DROP)
+        return -1;
+    if (refs[o] || refs[e] || refs[d] || l->buf[e].arg[0] <= d)
+        return -1;
+    return d;
+}
+
+static int by_value(const void *a, const void *b)
+{
+    const struct entry *x = a, *y = b;
+    if (x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    return x->order - y->order;
+}
+
+// the chain of tests from first, its tests and entries in order
+static int chain(struct insnlist *l, int *refs, int first, int *tests,
+                 struct entry *es, int *miss)
+{
+    int n = 0;
+    int i = first;
+    int d;
+    while ((d = test_at(l, refs, i)) >= 0) {
+        if (n > 0) {
+            int p = i - 1;
+            while (p >= 0 && l->buf[p].dead)
+                p--;
+            // reached only from the test before
+            if (refs[i] != 1 || p < 0 || !stops(l->buf[p].op))
+                break;
+        }
+        tests[n] = i;
+        es[n] = (struct entry){l->buf[i].arg[0], n, d};
+        n++;
+        i = l->buf[insn_next(l, insn_next(l, i))].arg[0];
+    }
+    *miss = i;
+    return n;
+}
+
+// a table at first for the n sorted entries without duplicates
+static void emit_table(struct insnlist *l, int first, struct entry *es, int n,
+                       int miss)
+{
+    data lo = es[0].value, hi = es[n - 1].value;
+    bool dense = (uintptr_t)hi - (uintptr_t)lo < 2 * (uintptr_t)n;
+    int size = dense ? hi - lo + 1 : n;
+    struct insn *t = insn_insert(l, first, size + 2);
+    // indices past first moved by the table
+    int moved = size + 2;
+    miss += moved;
+    t[0] = (struct insn){dense ? OP_JTAB : OP_BTAB, {size}};
+    for (int i = 0, k = 0; i < size; i++) {
+        data v = dense ? lo + i : es[i].value;
+        int target = miss;
+        if (k < n && es[k].value == v)
+            target = es[k++].target + moved;
+        t[i + 1] = (struct insn){OP_CASEJ, {v, target}};
+    }
+    t[size + 1] = (struct insn){OP_JMP, {miss}};
+}
+
+bool case_tables(struct insnlist *l)
+{
+    int *refs = calloc(l->size + 1, sizeof(int));
+    for (int i = 0; i < l->size; i++) {
+        data *t = insn_target(&l->buf[i]);
+        if (!l->buf[i].dead && t != NULL)
+            refs[*t]++;
+    }
+    int *tests = malloc(sizeof(int) * l->size);
+    struct entry *es = malloc(sizeof(struct entry) * l->size);
+    bool changed = false;
+    for (int i = 0; i < l->size && !changed; i++) {
+        int miss;
+        int n = chain(l, refs, i, tests, es, &miss);
+        if (n < CASE_MIN)
+            continue;
+        qsort(es, n, sizeof(struct entry), by_value);
+        int m = 0;
+        for (int k = 0; k < n; k++) {
+            if (m == 0 || es[k].value != es[m - 1].value)
+                es[m++] = es[k];
+        }
+        emit_table(l, i, es, m, miss);
+        // the tests are left unreachable, their drops are the entries
+        int moved = l->buf[i].arg[0] + 2;
+        for (int k = 0; k < n; k++) {
+            int p = tests[k] + moved;
+            int o = insn_next(l, p);
+            l->buf[insn_next(l, o)].dead = true;
+            l->buf[o].dead = true;
+            l->buf[p].dead = true;
+        }
+        changed = true;
+    }
+    free(es);
+    free(tests);
+    free(refs);
+    return changed;
+}
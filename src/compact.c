@@ -0,0 +1,573 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "compact.h"
+
+#include <stdlib.h>
+
+#include "insn.h"
+#include "vm.h"
+
+// code cells can't point at compact code when they are narrower than
+// pointers, the format needs 64 bit cells
+#if CELL_BITS == 64
+
+// Each instruction is one opcode byte followed by its operands as LEB128
+// varints. Word entries are unsigned, other operands signed and zig-zag
+// encoded, and a jump target is the distance from the end of the jump.
+// Compact words call each other inside compact_run, pushing byte pointers
+// on the return stack, so words reading their caller's return address stay
+// as cells.
+
+struct cbuf {
+    uint8_t *p;
+    size_t len;
+    size_t cap;
+};
+
+static void put8(struct cbuf *b, uint8_t x)
+{
+    if (b->len >= b->cap) {
+        b->cap = b->cap < 64 ? 64 : b->cap * 2;
+        b->p = realloc(b->p, b->cap);
+    }
+    b->p[b->len++] = x;
+}
+
+static uintptr_t zigzag(data x) { return ((uintptr_t)x << 1) ^ (x >> 63); }
+
+static int varint_len(uintptr_t x)
+{
+    int n = 1;
+    while (x >= 0x80) {
+        x >>= 7;
+        n++;
+    }
+    return n;
+}
+
+// padded with continuation bytes to at least len bytes
+static void put_varint(struct cbuf *b, uintptr_t x, int len)
+{
+    for (int n = 1; x >= 0x80 || n < len; n++) {
+        put8(b, (x & 0x7f) | 0x80);
+        x >>= 7;
+    }
+    put8(b, x);
+}
+
+static bool unsigned_operand(enum opcode op)
+{
+    return op == OP_CALL || op == OP_TAILCALL;
+}
+
+// calls keep only the entry, the linked address is a cell code detail
+static int compact_args(enum opcode op)
+{
+    return unsigned_operand(op) ? 1 : get_opargs(op);
+}
+
+// size of in, with its jump offset taking len bytes
+static int insn_size(struct insn *in, int len)
+{
+    int n = 1;
+    int nargs = compact_args(in->op);
+    for (int j = 0; j < nargs; j++) {
+        if (is_jump(in->op) && j == nargs - 1)
+            n += len;
+        else if (unsigned_operand(in->op))
+            n += varint_len(in->arg[j]);
+        else
+            n += varint_len(zigzag(in->arg[j]));
+    }
+    return n;
+}
+
+static bool encodable(struct insnlist *l)
+{
+    for (int i = 0; i < l->size; i++) {
+        enum opcode op = l->buf[i].op;
+        if (!l->buf[i].dead && (op == OP_NATIVE || op == OP_COMPACT))
+            return false;
+        // case tables index entries of a fixed size
+        if (!l->buf[i].dead && (op == OP_JTAB || op == OP_BTAB))
+            return false;
+    }
+    return insn_rs_balanced(l);
+}
+
+// offsets only grow from one byte until every jump fits, a jump keeps the
+// size it reached even if its offset gets shorter again
+static size_t layout(struct insnlist *l, int *len, size_t *pos)
+{
+    for (int i = 0; i < l->size; i++)
+        len[i] = 1;
+    bool again = true;
+    while (again) {
+        again = false;
+        pos[0] = 0;
+        for (int i = 0; i < l->size; i++) {
+            struct insn *in = &l->buf[i];
+            pos[i + 1] = pos[i] + (in->dead ? 0 : insn_size(in, len[i]));
+        }
+        for (int i = 0; i < l->size; i++) {
+            data *t = insn_target(&l->buf[i]);
+            if (l->buf[i].dead || t == NULL)
+                continue;
+            data off = pos[*t] - pos[i + 1];
+            if (varint_len(zigzag(off)) > len[i]) {
+                len[i] = varint_len(zigzag(off));
+                again = true;
+            }
+        }
+    }
+    return pos[l->size];
+}
+
+bool compact_available(void) { return true; }
+
+int compact_compile(struct forthvm *vm, data entry)
+{
+    data start = vm->dict[entry];
+    data end = vm->codesz;
+    struct insnlist l;
+    insn_init(&l);
+    if (start < 0 || insn_decode(vm, &l, start, end) < 0 || !encodable(&l)) {
+        insn_free(&l);
+        return -1;
+    }
+    int *len = malloc(sizeof(int) * (l.size + 1));
+    size_t *pos = malloc(sizeof(size_t) * (l.size + 1));
+    struct cbuf b = {0};
+    layout(&l, len, pos);
+    for (int i = 0; i < l.size; i++) {
+        struct insn *in = &l.buf[i];
+        if (in->dead)
+            continue;
+        put8(&b, in->op);
+        int nargs = compact_args(in->op);
+        for (int j = 0; j < nargs; j++) {
+            if (is_jump(in->op) && j == nargs - 1)
+                put_varint(&b, zigzag(pos[in->arg[j]] - pos[i + 1]), len[i]);
+            else if (unsigned_operand(in->op))
+                put_varint(&b, in->arg[j], 1);
+            else
+                put_varint(&b, zigzag(in->arg[j]), 1);
+        }
+    }
+    free(len);
+    free(pos);
+    insn_free(&l);
+    // compact code calls cell code through vm_call
+    vm_reserve_halt(vm);
+    vm->compactwords++;
+    vm->compactfrom += (end - start) * sizeof(data);
+    vm->compactto += b.len;
+    // the cells stay for inline_call
+    vm->dictcells[entry] = start;
+    vm_define(vm, entry, vm->codesz);
+    vm_emit_opcode(vm, OP_COMPACT);
+    vm_emit_data(vm, (data)b.p);
+    vm_emit_opcode(vm, OP_EXIT);
+    vm_mark_label(vm);
+    return 0;
+}
+
+#define UVARINT(x)                                                             \
+    do {                                                                       \
+        x = *ip++;                                                             \
+        if (x >= 0x80) {                                                       \
+            uintptr_t c_;                                                      \
+            int s_ = 7;                                                        \
+            x &= 0x7f;                                                         \
+            do {                                                               \
+                c_ = *ip++;                                                    \
+                x |= (c_ & 0x7f) << s_;                                        \
+                s_ += 7;                                                       \
+            } while (c_ & 0x80);                                               \
+        }                                                                      \
+    } while (0)
+
+#define SVARINT(x)                                                             \
+    do {                                                                       \
+        uintptr_t u_;                                                          \
+        UVARINT(u_);                                                           \
+        x = (data)(u_ >> 1) ^ -(data)(u_ & 1);                                 \
+    } while (0)
+
+#define SAVE()                                                                 \
+    do {                                                                       \
+        vm->dsp = sp - vm->ds;                                                 \
+        vm->rsp = rp - vm->rs;                                                 \
+    } while (0)
+
+#define LOAD()                                                                 \
+    do {                                                                       \
+        sp = vm->ds + vm->dsp;                                                 \
+        rp = vm->rs + vm->rsp;                                                 \
+    } while (0)
+
+#define FAIL(msg)                                                              \
+    do {                                                                       \
+        SAVE();                                                                \
+        vm_error(vm, msg);                                                     \
+    } while (0)
+
+#define SLOW(f)                                                                \
+    do {                                                                       \
+        SAVE();                                                                \
+        (f)(vm);                                                               \
+        LOAD();                                                                \
+    } while (0)
+
+// a is the second element and b the top, as in the threaded engine
+#define BINOP(expr)                                                            \
+    do {                                                                       \
+        b = sp[0];                                                             \
+        a = sp[-1];                                                            \
+        *--sp = (expr);                                                        \
+    } while (0)
+
+#define UNOP(expr)                                                             \
+    do {                                                                       \
+        a = sp[0];                                                             \
+        sp[0] = (expr);                                                        \
+    } while (0)
+
+#define JUMPIF(cond)                                                           \
+    do {                                                                       \
+        SVARINT(off);                                                          \
+        if (cond)                                                              \
+            ip += off;                                                         \
+    } while (0)
+
+#define CMPJZ(cond)                                                            \
+    do {                                                                       \
+        b = sp[0];                                                             \
+        a = sp[-1];                                                            \
+        sp -= 2;                                                               \
+        JUMPIF(!(cond));                                                       \
+    } while (0)
+
+#define CMPIJZ(cond)                                                           \
+    do {                                                                       \
+        SVARINT(b);                                                            \
+        a = *sp--;                                                             \
+        JUMPIF(!(cond));                                                       \
+    } while (0)
+
+void compact_run(struct forthvm *vm, const uint8_t *ip)
+{
+    data *sp, *rp;
+    data a, b, off;
+    uintptr_t entry;
+    // compact calls made since entering, their returns are on rp
+    int depth = 0;
+    LOAD();
+    for (;;) {
+        enum opcode op = *ip++;
+        switch (op) {
+        case OP_ADD:
+            BINOP(a + b);
+            break;
+        case OP_MINUS:
+            BINOP(a - b);
+            break;
+        case OP_MUL:
+            BINOP(a * b);
+            break;
+        case OP_DIV:
+            BINOP(a / b);
+            break;
+        case OP_MOD:
+            BINOP(a % b);
+            break;
+        case OP_DIVMOD:
+            b = sp[0];
+            a = sp[-1];
+            sp[-1] = a % b;
+            sp[0] = a / b;
+            break;
+        case OP_MIN:
+            BINOP(a < b ? a : b);
+            break;
+        case OP_MAX:
+            BINOP(a > b ? a : b);
+            break;
+        case OP_NEGATE:
+            UNOP(-a);
+            break;
+        case OP_EQ:
+            BINOP(a == b ? -1 : 0);
+            break;
+        case OP_NEQ:
+            BINOP(a == b ? 0 : -1);
+            break;
+        case OP_GT:
+            BINOP(a > b ? -1 : 0);
+            break;
+        case OP_LT:
+            BINOP(a < b ? -1 : 0);
+            break;
+        case OP_GE:
+            BINOP(a >= b ? -1 : 0);
+            break;
+        case OP_LE:
+            BINOP(a <= b ? -1 : 0);
+            break;
+        case OP_AND:
+            BINOP(a && b ? -1 : 0);
+            break;
+        case OP_OR:
+            BINOP(a || b ? -1 : 0);
+            break;
+        case OP_NOT:
+            UNOP(a ? 0 : -1);
+            break;
+        case OP_BITAND:
+            BINOP(a & b);
+            break;
+        case OP_BITOR:
+            BINOP(a | b);
+            break;
+        case OP_INVERT:
+            UNOP(~a);
+            break;
+        case OP_XOR:
+            BINOP(a ^ b);
+            break;
+        case OP_DUP:
+            a = sp[0];
+            *++sp = a;
+            break;
+        case OP_OVER:
+            a = sp[-1];
+            *++sp = a;
+            break;
+        case OP_SWAP:
+            a = sp[0];
+            sp[0] = sp[-1];
+            sp[-1] = a;
+            break;
+        case OP_DROP:
+            // fault now if the stack is empty
+            (void)*(volatile data *)sp;
+            sp--;
+            break;
+        case OP_ROT:
+            a = sp[-2];
+            sp[-2] = sp[-1];
+            sp[-1] = sp[0];
+            sp[0] = a;
+            break;
+        case OP_2DUP:
+            a = sp[-1];
+            b = sp[0];
+            sp += 2;
+            sp[-1] = a;
+            sp[0] = b;
+            break;
+        case OP_CELLS:
+            UNOP(a * sizeof(data));
+            break;
+        case OP_CHARS:
+            UNOP(a);
+            break;
+        case OP_AT:
+            UNOP(*(data *)a);
+            break;
+        case OP_BANG:
+            *(data *)sp[0] = sp[-1];
+            sp -= 2;
+            break;
+        case OP_PUSH:
+            SVARINT(a);
+            *++sp = a;
+            break;
+        case OP_ADDI:
+            SVARINT(b);
+            UNOP(a + b);
+            break;
+        case OP_SHLI:
+            SVARINT(b);
+            UNOP((uintptr_t)a << b);
+            break;
+        case OP_SHRI:
+            SVARINT(b);
+            UNOP((a + (a < 0 ? ((data)1 << b) - 1 : 0)) >> b);
+            break;
+        case OP_PICKI:
+            SVARINT(a);
+            b = sp[-a];
+            *++sp = b;
+            break;
+        case OP_NEEDS:
+            SVARINT(a);
+            if (sp - vm->ds < a)
+                FAIL("no enough element on data stack");
+            break;
+        case OP_D2R:
+            a = *sp--;
+            *++rp = a;
+            break;
+        case OP_R2D:
+            a = *rp--;
+            *++sp = a;
+            break;
+        case OP_RAT:
+        case OP_I:
+            a = rp[0];
+            *++sp = a;
+            break;
+        case OP_II:
+            a = rp[-1];
+            *++sp = a;
+            break;
+        case OP_J:
+            a = rp[-2];
+            *++sp = a;
+            break;
+        case OP_DO:
+            JUMPIF(rp[0] >= rp[-1]);
+            break;
+        case OP_LOOP:
+            rp[0]++;
+            JUMPIF(rp[0] < rp[-1]);
+            break;
+        case OP_PLUSLOOP:
+            rp[0] += *sp--;
+            JUMPIF(rp[0] < rp[-1]);
+            break;
+        case OP_UNLOOP:
+            rp -= 2;
+            break;
+        case OP_JMP:
+            JUMPIF(true);
+            break;
+        case OP_JZ:
+            a = *sp--;
+            JUMPIF(a == 0);
+            break;
+        case OP_JNZ:
+            a = *sp--;
+            JUMPIF(a != 0);
+            break;
+        case OP_DUPJZ:
+            JUMPIF(sp[0] == 0);
+            break;
+        case OP_DUPJNZ:
+            JUMPIF(sp[0] != 0);
+            break;
+        case OP_EQJZ:
+            CMPJZ(a == b);
+            break;
+        case OP_NEQJZ:
+            CMPJZ(a != b);
+            break;
+        case OP_LTJZ:
+            CMPJZ(a < b);
+            break;
+        case OP_GTJZ:
+            CMPJZ(a > b);
+            break;
+        case OP_LEJZ:
+            CMPJZ(a <= b);
+            break;
+        case OP_GEJZ:
+            CMPJZ(a >= b);
+            break;
+        case OP_EQIJZ:
+            CMPIJZ(a == b);
+            break;
+        case OP_NEQIJZ:
+            CMPIJZ(a != b);
+            break;
+        case OP_LTIJZ:
+            CMPIJZ(a < b);
+            break;
+        case OP_GTIJZ:
+            CMPIJZ(a > b);
+            break;
+        case OP_LEIJZ:
+            CMPIJZ(a <= b);
+            break;
+        case OP_GEIJZ:
+            CMPIJZ(a >= b);
+            break;
+        case OP_CFUNC:
+            SVARINT(a);
+            SLOW(*(opfunc *)&a);
+            break;
+        case OP_CALL:
+            UVARINT(entry);
+            a = vm->dict[entry];
+            if (a < 0)
+                FAIL("undefined word");
+            goto call;
+        case OP_EXECUTE:
+            a = *sp--;
+        call:
+            if (vm->code[a] == vm->optab[OP_COMPACT]) {
+                *++rp = (data)ip;
+                depth++;
+                ip = (const uint8_t *)vm->code[a + 1];
+                break;
+            }
+            SAVE();
+            vm_call_at(vm, a);
+            LOAD();
+            break;
+        case OP_TAILCALL:
+            UVARINT(entry);
+            a = vm->dict[entry];
+            if (a < 0)
+                FAIL("undefined word");
+            if (vm->code[a] == vm->optab[OP_COMPACT]) {
+                ip = (const uint8_t *)vm->code[a + 1];
+                break;
+            }
+            SAVE();
+            vm_call(vm, entry);
+            LOAD();
+            goto exit;
+        case OP_EXIT:
+        exit:
+            if (depth == 0) {
+                SAVE();
+                return;
+            }
+            ip = (const uint8_t *)*rp--;
+            depth--;
+            break;
+        case OP_NOP:
+            break;
+        default:
+            SLOW(get_opfunc(op));
+            break;
+        }
+    }
+}
+
+#else
+
+bool compact_available(void) { return false; }
+
+int compact_compile(struct forthvm *vm, data entry) { return -1; }
+
+void compact_run(struct forthvm *vm, const uint8_t *ip) {}
+
+#endif
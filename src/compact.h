@@ -0,0 +1,35 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_COMPACT_H_
+#define REINFORTH_COMPACT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+struct forthvm;
+
+bool compact_available(void);
+// re-encode the definition of entry in the compact format and point the
+// word at it, returns -1 and leaves the word alone if it cannot be
+int compact_compile(struct forthvm *vm, data entry);
+// run compact code until the word it belongs to returns, from OP_COMPACT
+void compact_run(struct forthvm *vm, const uint8_t *ip);
+
+#endif
@@ -17,6 +17,8 @@
 
 #include "crc32.h"
 
+#include <stdbool.h>
+
 const uint32_t crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
     0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -62,11 +64,91 @@ const uint32_t crc32_tab[] = {
     0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d};
 
-uint32_t crc32(uint32_t crc, void *buf, int size)
+uint32_t crc32(uint32_t crc, const void *buf, int size)
 {
-    uint8_t *p = buf;
+    const uint8_t *p = buf;
     crc = ~crc;
     while (size--)
         crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
     return ~crc;
 }
+
+// CRC-32C, the polynomial of the SSE4.2 crc32 instruction, used when the
+// cpu has it and computed eight bytes at a time from tables otherwise
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_tab[8][256];
+
+static void crc32c_init(void)
+{
+    static bool done;
+    if (done)
+        return;
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_tab[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = crc32c_tab[t - 1][i];
+            crc32c_tab[t][i] = (c >> 8) ^ crc32c_tab[0][c & 0xff];
+        }
+    }
+    done = true;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, int size)
+{
+    crc32c_init();
+    for (; size >= 8; p += 8, size -= 8) {
+        uint32_t lo =
+            crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = crc32c_tab[7][lo & 0xff] ^ crc32c_tab[6][(lo >> 8) & 0xff] ^
+              crc32c_tab[5][(lo >> 16) & 0xff] ^ crc32c_tab[4][lo >> 24] ^
+              crc32c_tab[3][p[4]] ^ crc32c_tab[2][p[5]] ^
+              crc32c_tab[1][p[6]] ^ crc32c_tab[0][p[7]];
+    }
+    while (size--)
+        crc = crc32c_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <nmmintrin.h>
+#include <string.h>
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t *p, int size)
+{
+    uint64_t c = crc;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        c = _mm_crc32_u64(c, x);
+    }
+    while (size--)
+        c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, int size)
+{
+    static int hw = -1;
+    if (hw < 0)
+        hw = __builtin_cpu_supports("sse4.2");
+    crc = ~crc;
+    crc = hw ? crc32c_hw(crc, buf, size) : crc32c_sw(crc, buf, size);
+    return ~crc;
+}
+
+#else
+
+uint32_t crc32c(uint32_t crc, const void *buf, int size)
+{
+    return ~crc32c_sw(~crc, buf, size);
+}
+
+#endif
@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 
-uint32_t crc32(uint32_t r, void *buf, int size);
+uint32_t crc32(uint32_t r, const void *buf, int size);
+uint32_t crc32c(uint32_t r, const void *buf, int size);
 
 #endif
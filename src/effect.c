@@ -0,0 +1,279 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "effect.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include "insn.h"
+#include "vm.h"
+
+// The depth of the data stack before each instruction, relative to the
+// depth the word is entered with, is propagated along jumps and fall
+// through. A word has a known effect if every instruction has one and
+// every path reaching an instruction agrees on its depth, so a loop
+// leaving cells behind has none. The lowest depth reached is what the word
+// takes, the depth at its exits what it leaves on top of that.
+
+// depth of an instruction no path has reached yet
+#define UNSET INT_MIN
+// deeper picks keep their check, the jit needs their offset in 32 bits
+#define PICKI_MAX (1 << 20)
+
+struct effect {
+    int in;
+    int out;
+};
+
+struct infer {
+    struct forthvm *vm;
+    struct insnlist *l;
+    bool *label;
+    data self;
+    // effect assumed for recursive calls, in < 0 for none yet
+    struct effect rec;
+    int *depth;
+    int *work;
+    int nwork;
+};
+
+// the index of a pick right after a literal, or -1
+static data pick_index(struct infer *s, int i)
+{
+    struct insn *in = &s->l->buf[i];
+    if (in->op != OP_PICK || i == 0 || s->label[i])
+        return -1;
+    struct insn *prev = &s->l->buf[i - 1];
+    if (prev->op != OP_PUSH || prev->arg[0] < 0 || prev->arg[0] > PICKI_MAX)
+        return -1;
+    return prev->arg[0];
+}
+
+// 1 if the effect of instruction i is known, 0 if not and -1 for a
+// recursive call while nothing is assumed for them, ending that path
+static int insn_effect(struct infer *s, int i, int *in, int *out)
+{
+    struct insn *ins = &s->l->buf[i];
+    struct forthvm *vm = s->vm;
+    data arg = ins->arg[0];
+    switch (ins->op) {
+    case OP_CALL:
+    case OP_TAILCALL:
+        if (arg == s->self) {
+            *in = s->rec.in;
+            *out = s->rec.out;
+            return *in < 0 ? -1 : 1;
+        }
+        // words meant to be redefined may change their effect
+        if (vm->dictflags[arg] & WORD_NOINLINE)
+            return 0;
+        *in = vm->dictin[arg];
+        *out = vm->dictout[arg];
+        return *in >= 0;
+    case OP_PICK:
+        arg = pick_index(s, i);
+        *in = arg + 2;
+        *out = arg + 2;
+        return arg >= 0;
+    case OP_PICKI:
+        *in = arg + 1;
+        *out = arg + 2;
+        return 1;
+    case OP_NEEDS:
+        *in = arg;
+        *out = arg;
+        return 1;
+    default:
+        return get_opeffect(ins->op, in, out);
+    }
+}
+
+static bool reach(struct infer *s, int i, int depth)
+{
+    if (s->depth[i] == UNSET) {
+        s->depth[i] = depth;
+        s->work[s->nwork++] = i;
+        return true;
+    }
+    return s->depth[i] == depth;
+}
+
+static bool leave(int *out, int depth)
+{
+    if (*out != UNSET && *out != depth)
+        return false;
+    *out = depth;
+    return true;
+}
+
+static bool infer(struct infer *s, struct effect *e)
+{
+    struct insnlist *l = s->l;
+    int low = 0;
+    int out = UNSET;
+    for (int i = 0; i <= l->size; i++)
+        s->depth[i] = UNSET;
+    s->nwork = 0;
+    reach(s, 0, 0);
+    while (s->nwork > 0) {
+        int i = s->work[--s->nwork];
+        int d = s->depth[i];
+        int in, push;
+        if (i == l->size) {
+            if (!leave(&out, d))
+                return false;
+            continue;
+        }
+        struct insn *ins = &l->buf[i];
+        int known = insn_effect(s, i, &in, &push);
+        if (known == 0)
+            return false;
+        if (known < 0)
+            continue;
+        if (d - in < low)
+            low = d - in;
+        d += push - in;
+        if (ins->op == OP_EXIT || ins->op == OP_TAILCALL) {
+            if (!leave(&out, d))
+                return false;
+            continue;
+        }
+        if (ins->op == OP_BYE)
+            continue;
+        data *t = insn_target(ins);
+        if (t != NULL && !reach(s, *t, d))
+            return false;
+        if (ins->op != OP_JMP && !reach(s, i + 1, d))
+            return false;
+    }
+    if (out == UNSET)
+        return false;
+    e->in = -low;
+    e->out = out - low;
+    return true;
+}
+
+// recursive calls are first left out, then assumed to have the effect
+// found without them, which must come out again
+static bool infer_word(struct infer *s, struct effect *e)
+{
+    struct effect again;
+    s->rec.in = -1;
+    if (!infer(s, e))
+        return false;
+    s->rec = *e;
+    return infer(s, &again) && again.in == e->in && again.out == e->out;
+}
+
+// Picks reading only cells the word pushed itself need no check. Those
+// that reach into the caller's cells and run on every call, before any
+// branch, share a single check on entry, the others keep theirs.
+static void rewrite(struct infer *s, data start)
+{
+    struct forthvm *vm = s->vm;
+    struct insnlist *l = s->l;
+    bool first = true;
+    bool changed = false;
+    int need = 0;
+    for (int i = 0; i < l->size; i++) {
+        struct insn *in = &l->buf[i];
+        data k = pick_index(s, i);
+        int d = s->depth[i];
+        int reads = -1;
+        if (k >= 0)
+            reads = k + 2;
+        else if (in->op == OP_PICKI)
+            reads = in->arg[0] + 1;
+        else if (in->op == OP_NEEDS)
+            reads = in->arg[0];
+        if (reads >= 0 && d != UNSET && (reads <= d || first)) {
+            if (reads - d > need)
+                need = reads - d;
+            if (in->op == OP_NEEDS) {
+                in->dead = true;
+            } else if (k >= 0) {
+                l->buf[i - 1].dead = true;
+                in->op = k == 0 ? OP_DUP : k == 1 ? OP_OVER : OP_PICKI;
+                in->arg[0] = k;
+            }
+            changed = true;
+        }
+        if (is_jump(in->op) || in->op == OP_EXIT || in->op == OP_TAILCALL ||
+            in->op == OP_BYE)
+            first = false;
+    }
+    if (!changed)
+        return;
+    vm->codesz = start;
+    vm_mark_label(vm);
+    if (need > 0) {
+        vm_emit_opcode(vm, OP_NEEDS);
+        vm_emit_data(vm, need);
+    }
+    insn_encode(vm, l);
+}
+
+void effect_infer(struct forthvm *vm, data entry)
+{
+    data start = vm->dict[entry];
+    struct insnlist l;
+    vm->dictin[entry] = -1;
+    vm->dictout[entry] = -1;
+    insn_init(&l);
+    if (insn_decode(vm, &l, start, vm->codesz) < 0) {
+        insn_free(&l);
+        return;
+    }
+    struct infer s = {vm, &l};
+    s.self = entry;
+    s.label = calloc(l.size + 1, sizeof(bool));
+    s.depth = malloc(sizeof(int) * (l.size + 1));
+    s.work = malloc(sizeof(int) * (l.size + 1));
+    for (int i = 0; i < l.size; i++) {
+        data *t = insn_target(&l.buf[i]);
+        if (t != NULL)
+            s.label[*t] = true;
+    }
+    struct effect e;
+    if (infer_word(&s, &e)) {
+        vm->dictin[entry] = e.in;
+        vm->dictout[entry] = e.out;
+        if (vm->opts & OPT_EFFECT)
+            rewrite(&s, start);
+    }
+    free(s.label);
+    free(s.depth);
+    free(s.work);
+    insn_free(&l);
+}
+
+void effect_print(struct forthvm *vm, data entry)
+{
+    int in = -1;
+    int out = -1;
+    if (entry >= 0 && entry < (data)OP_NOP) {
+        get_opeffect(entry, &in, &out);
+    } else if (entry >= 0) {
+        in = vm->dictin[entry];
+        out = vm->dictout[entry];
+    }
+    if (in < 0)
+        fprintf(vm->out, "( ? )");
+    else
+        fprintf(vm->out, "( %d -- %d )", in, out);
+}
@@ -0,0 +1,315 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fold.h"
+
+#include <stdlib.h>
+
+#include "insn.h"
+#include "opcode.h"
+
+// the deepest literals are forgotten past this
+#define FOLD_DEPTH 16
+
+// The data stack is evaluated symbolically from each branch target on.
+// at[] holds the live pushes whose values are on top of the stack, at[n - 1]
+// the top one, and stays empty after anything that is not understood.
+struct known {
+    int at[FOLD_DEPTH];
+    int n;
+};
+
+static data *value(struct insnlist *l, struct known *k, int depth)
+{
+    return &l->buf[k->at[k->n - 1 - depth]].arg[0];
+}
+
+static void push(struct known *k, int i)
+{
+    if (k->n == FOLD_DEPTH) {
+        for (int j = 1; j < FOLD_DEPTH; j++)
+            k->at[j - 1] = k->at[j];
+        k->n--;
+    }
+    k->at[k->n++] = i;
+}
+
+// drop the top n pushes from the code
+static void kill(struct insnlist *l, struct known *k, int n)
+{
+    for (int j = 0; j < n; j++)
+        l->buf[k->at[--k->n]].dead = true;
+}
+
+// in becomes the push of x
+static void to_push(struct known *k, struct insn *in, int i, data x)
+{
+    in->op = OP_PUSH;
+    in->arg[0] = x;
+    push(k, i);
+}
+
+static int log2_exact(data x)
+{
+    if (x <= 1 || (x & (x - 1)) != 0)
+        return -1;
+    return __builtin_ctzll(x);
+}
+
+// a op b, false for what must still fail or is undefined at run time
+static bool binary(enum opcode op, data a, data b, data *r)
+{
+    uintptr_t ua = a, ub = b;
+    switch (op) {
+    case OP_ADD:
+        *r = ua + ub;
+        return true;
+    case OP_MINUS:
+        *r = ua - ub;
+        return true;
+    case OP_MUL:
+        *r = ua * ub;
+        return true;
+    case OP_DIV:
+    case OP_MOD:
+        if (b == 0 || (b == -1 && a == INTPTR_MIN))
+            return false;
+        *r = op == OP_DIV ? a / b : a % b;
+        return true;
+    case OP_MIN:
+        *r = a < b ? a : b;
+        return true;
+    case OP_MAX:
+        *r = a > b ? a : b;
+        return true;
+    case OP_EQ:
+        *r = a == b ? -1 : 0;
+        return true;
+    case OP_NEQ:
+        *r = a != b ? -1 : 0;
+        return true;
+    case OP_LT:
+        *r = a < b ? -1 : 0;
+        return true;
+    case OP_GT:
+        *r = a > b ? -1 : 0;
+        return true;
+    case OP_LE:
+        *r = a <= b ? -1 : 0;
+        return true;
+    case OP_GE:
+        *r = a >= b ? -1 : 0;
+        return true;
+    case OP_AND:
+        *r = a && b ? -1 : 0;
+        return true;
+    case OP_OR:
+        *r = a || b ? -1 : 0;
+        return true;
+    case OP_BITAND:
+        *r = a & b;
+        return true;
+    case OP_BITOR:
+        *r = a | b;
+        return true;
+    case OP_XOR:
+        *r = a ^ b;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// op applied to a, with the operand n of the instruction if it has one
+static bool unary(enum opcode op, data a, data n, data *r)
+{
+    uintptr_t ua = a;
+    switch (op) {
+    case OP_NEGATE:
+        *r = -ua;
+        return true;
+    case OP_INVERT:
+        *r = ~a;
+        return true;
+    case OP_NOT:
+        *r = a ? 0 : -1;
+        return true;
+    case OP_CELLS:
+        *r = ua * sizeof(data);
+        return true;
+    case OP_CHARS:
+        *r = a;
+        return true;
+    case OP_ADDI:
+        *r = ua + n;
+        return true;
+    case OP_SHLI:
+        *r = ua << n;
+        return true;
+    case OP_SHRI:
+        *r = a / ((data)1 << n);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the compare of a fused compare and jump
+static enum opcode jump_compare(enum opcode op)
+{
+    switch (op) {
+    case OP_EQJZ:
+    case OP_EQIJZ:
+        return OP_EQ;
+    case OP_NEQJZ:
+    case OP_NEQIJZ:
+        return OP_NEQ;
+    case OP_LTJZ:
+    case OP_LTIJZ:
+        return OP_LT;
+    case OP_GTJZ:
+    case OP_GTIJZ:
+        return OP_GT;
+    case OP_LEJZ:
+    case OP_LEIJZ:
+        return OP_LE;
+    case OP_GEJZ:
+    case OP_GEIJZ:
+        return OP_GE;
+    default:
+        return OP_NOP;
+    }
+}
+
+// a jump whose condition is known is taken always or never
+static void resolve(struct insn *in, bool taken)
+{
+    if (!taken) {
+        in->dead = true;
+        return;
+    }
+    data *t = insn_target(in);
+    in->arg[0] = *t;
+    in->op = OP_JMP;
+}
+
+// x op b with only the literal b known, k has b on top
+static bool reduce(struct insnlist *l, struct known *k, struct insn *in)
+{
+    struct insn *lit = &l->buf[k->at[k->n - 1]];
+    data b = lit->arg[0];
+    int shift = log2_exact(b);
+    if ((in->op == OP_MUL || in->op == OP_DIV) && b == 1) {
+        lit->dead = true;
+        in->dead = true;
+    } else if ((in->op == OP_MUL || in->op == OP_DIV) && b == -1) {
+        lit->dead = true;
+        in->op = OP_NEGATE;
+    } else if (in->op == OP_MUL && b == 0) {
+        lit->op = OP_DROP;
+        in->op = OP_PUSH;
+        in->arg[0] = 0;
+    } else if ((in->op == OP_MUL || in->op == OP_DIV) && shift > 0) {
+        lit->dead = true;
+        in->op = in->op == OP_MUL ? OP_SHLI : OP_SHRI;
+        in->arg[0] = shift;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool fold_constants(struct insnlist *l)
+{
+    bool changed = false;
+    bool *label = calloc(l->size + 1, sizeof(bool));
+    for (int i = 0; i < l->size; i++) {
+        data *t = insn_target(&l->buf[i]);
+        if (!l->buf[i].dead && t != NULL)
+            label[*t] = true;
+    }
+    struct known k = {0};
+    for (int i = 0; i < l->size; i++) {
+        struct insn *in = &l->buf[i];
+        data r, x;
+        if (label[i])
+            k.n = 0;
+        if (in->dead || in->op == OP_NOP)
+            continue;
+        enum opcode op = in->op;
+        bool done = true;
+        if (op == OP_PUSH) {
+            push(&k, i);
+            continue;
+        } else if (k.n >= 2 && binary(op, *value(l, &k, 1), *value(l, &k, 0),
+                                      &r)) {
+            kill(l, &k, 2);
+            to_push(&k, in, i, r);
+        } else if (k.n >= 1 && unary(op, *value(l, &k, 0), in->arg[0], &r)) {
+            kill(l, &k, 1);
+            to_push(&k, in, i, r);
+        } else if (k.n >= 1 && op == OP_DUP) {
+            to_push(&k, in, i, *value(l, &k, 0));
+        } else if (k.n >= 2 && op == OP_OVER) {
+            to_push(&k, in, i, *value(l, &k, 1));
+        } else if (k.n >= 1 && op == OP_DROP) {
+            kill(l, &k, 1);
+            in->dead = true;
+        } else if (k.n >= 2 && op == OP_SWAP) {
+            x = *value(l, &k, 0);
+            *value(l, &k, 0) = *value(l, &k, 1);
+            *value(l, &k, 1) = x;
+            in->dead = true;
+        } else if (k.n >= 3 && op == OP_ROT) {
+            x = *value(l, &k, 2);
+            *value(l, &k, 2) = *value(l, &k, 1);
+            *value(l, &k, 1) = *value(l, &k, 0);
+            *value(l, &k, 0) = x;
+            in->dead = true;
+        } else if (k.n >= 1 && (op == OP_JZ || op == OP_JNZ)) {
+            x = *value(l, &k, 0);
+            kill(l, &k, 1);
+            resolve(in, op == OP_JZ ? x == 0 : x != 0);
+            k.n = 0;
+        } else if (k.n >= 1 && (op == OP_DUPJZ || op == OP_DUPJNZ)) {
+            x = *value(l, &k, 0);
+            resolve(in, op == OP_DUPJZ ? x == 0 : x != 0);
+            k.n = 0;
+        } else if (k.n >= 1 && jump_compare(op) != OP_NOP &&
+                   get_opargs(op) == 2) {
+            binary(jump_compare(op), *value(l, &k, 0), in->arg[0], &r);
+            kill(l, &k, 1);
+            resolve(in, r == 0);
+            k.n = 0;
+        } else if (k.n >= 2 && jump_compare(op) != OP_NOP) {
+            binary(jump_compare(op), *value(l, &k, 1), *value(l, &k, 0), &r);
+            kill(l, &k, 2);
+            resolve(in, r == 0);
+            k.n = 0;
+        } else if (k.n >= 1 && reduce(l, &k, in)) {
+            k.n = 0;
+        } else if (op == OP_ADDI && in->arg[0] == 0) {
+            in->dead = true;
+        } else {
+            done = false;
+            k.n = 0;
+        }
+        changed |= done;
+    }
+    free(label);
+    return changed;
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fuse.h"
+
+#include <string.h>
+
+#include "vm.h"
+
+struct fuse_rule {
+    enum opcode prev;
+    enum opcode op;
+    enum opcode fused;
+    char *name;
+};
+
+// a rule whose prev is OP_PUSH moves the literal into the fused instruction
+// as its first operand, except "0 =" which needs none
+static struct fuse_rule rules[] = {
+    {OP_PUSH, OP_ADD, OP_ADDI, "n +"},
+    {OP_PUSH, OP_MINUS, OP_ADDI, "n -"},
+    {OP_PUSH, OP_EQ, OP_NOT, "0 ="},
+    {OP_OVER, OP_OVER, OP_2DUP, "over over"},
+    {OP_NOT, OP_JZ, OP_JNZ, "not if"},
+    {OP_DUP, OP_JZ, OP_DUPJZ, "dup if"},
+    {OP_DUP, OP_JNZ, OP_DUPJNZ, "dup not if"},
+    {OP_EQ, OP_JZ, OP_EQJZ, "= if"},
+    {OP_NEQ, OP_JZ, OP_NEQJZ, "<> if"},
+    {OP_LT, OP_JZ, OP_LTJZ, "< if"},
+    {OP_GT, OP_JZ, OP_GTJZ, "> if"},
+    {OP_LE, OP_JZ, OP_LEJZ, "<= if"},
+    {OP_GE, OP_JZ, OP_GEJZ, ">= if"},
+    {OP_PUSH, OP_EQJZ, OP_EQIJZ, "n = if"},
+    {OP_PUSH, OP_NEQJZ, OP_NEQIJZ, "n <> if"},
+    {OP_PUSH, OP_LTJZ, OP_LTIJZ, "n < if"},
+    {OP_PUSH, OP_GTJZ, OP_GTIJZ, "n > if"},
+    {OP_PUSH, OP_LEJZ, OP_LEIJZ, "n <= if"},
+    {OP_PUSH, OP_GEJZ, OP_GEIJZ, "n >= if"},
+};
+
+#define NRULES (int)(sizeof(rules) / sizeof(rules[0]))
+
+_Static_assert(NRULES <= FUSE_MAXRULES, "too many fusion rules");
+
+bool fuse_opcode(struct forthvm *vm, enum opcode op)
+{
+    if (!(vm->opts & OPT_FUSE) || vm->nrecent == 0)
+        return false;
+    data pos = vm->recentpos[vm->nrecent - 1];
+    enum opcode prev = vm->recentop[vm->nrecent - 1];
+    for (int i = 0; i < NRULES; i++) {
+        struct fuse_rule *r = &rules[i];
+        if (r->prev != prev || r->op != op)
+            continue;
+        data imm = 0;
+        bool hasimm = prev == OP_PUSH && r->fused != OP_NOT;
+        if (prev == OP_PUSH) {
+            imm = vm->code[pos + 1];
+            if (r->fused == OP_NOT && imm != 0)
+                continue;
+            if (op == OP_MINUS)
+                imm = -imm;
+        }
+        vm->nrecent--;
+        vm->codesz = pos;
+        vm->fusecnt[i]++;
+        // the fused instruction may itself fuse with the one before
+        vm_emit_opcode(vm, r->fused);
+        if (hasimm)
+            vm_emit_data(vm, imm);
+        return true;
+    }
+    return false;
+}
+
+void fuse_record(struct forthvm *vm, data pos, enum opcode op)
+{
+    if (vm->nrecent == FUSE_WINDOW) {
+        memmove(vm->recentpos, vm->recentpos + 1,
+                sizeof(data) * (FUSE_WINDOW - 1));
+        memmove(vm->recentop, vm->recentop + 1,
+                sizeof(enum opcode) * (FUSE_WINDOW - 1));
+        vm->nrecent--;
+    }
+    vm->recentpos[vm->nrecent] = pos;
+    vm->recentop[vm->nrecent] = op;
+    vm->nrecent++;
+}
+
+void fuse_reset(struct forthvm *vm) { vm->nrecent = 0; }
+
+void fuse_report(struct forthvm *vm)
+{
+    for (int i = 0; i < NRULES; i++) {
+        if (vm->fusecnt[i] == 0)
+            continue;
+        char *name = get_opname(rules[i].fused);
+        fprintf(vm->out, "%-12s %-8.*s %ld\n", rules[i].name,
+                (int)strcspn(name, "\t"), name, (long)vm->fusecnt[i]);
+    }
+}
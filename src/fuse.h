@@ -0,0 +1,37 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_FUSE_H_
+#define REINFORTH_FUSE_H_
+
+#include <stdbool.h>
+
+#include "opcode.h"
+
+#define FUSE_MAXRULES 32
+#define FUSE_WINDOW 4
+
+struct forthvm;
+
+// try to merge op with the instructions emitted just before it, returns
+// true if op has been emitted in a fused form
+bool fuse_opcode(struct forthvm *vm, enum opcode op);
+void fuse_record(struct forthvm *vm, data pos, enum opcode op);
+void fuse_reset(struct forthvm *vm);
+void fuse_report(struct forthvm *vm);
+
+#endif
@@ -0,0 +1,251 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "inline.h"
+
+#include <stdlib.h>
+
+#include "insn.h"
+#include "tier.h"
+#include "vm.h"
+
+// longest body inlined, in instructions without the final exit
+#define INLINE_MAX 8
+
+// a copied body runs on the caller's return stack frame
+static bool uses_rs(enum opcode op)
+{
+    switch (op) {
+    case OP_D2R:
+    case OP_R2D:
+    case OP_RAT:
+    case OP_I:
+    case OP_II:
+    case OP_J:
+    case OP_RPICK:
+    case OP_DO:
+    case OP_LOOP:
+    case OP_PLUSLOOP:
+    case OP_UNLOOP:
+    case OP_RDUMP:
+    case OP_MEMO:
+    case OP_MEMOSAVE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// end of the body starting at start, or -1 if it must not be inlined. The
+// body ends at the first exit that no jump goes past.
+static data body_end(struct forthvm *vm, data entry, data start)
+{
+    data pc = start;
+    data reach = start;
+    for (int n = 0; n <= INLINE_MAX; n++) {
+        if (pc >= vm->codesz)
+            return -1;
+        int op = vm_decode(vm, vm->code[pc]);
+        if (op < 0 || uses_rs(op) || pc + get_opargs(op) >= vm->codesz)
+            return -1;
+        // a stub is never copied, see inline_call
+        if (op == OP_NATIVE || op == OP_COMPACT)
+            return -1;
+        // the count of a first tier word is not copied
+        if (op == OP_TICK)
+            n--;
+        if ((op == OP_CALL || op == OP_TAILCALL) &&
+            (vm->code[pc + 1] == entry || vm->code[pc + 1] == vm->lastword))
+            return -1;
+        if (is_jump(op) && vm->code[pc + get_opargs(op)] > reach)
+            reach = vm->code[pc + get_opargs(op)];
+        if (op == OP_EXIT && pc >= reach)
+            return pc + 1;
+        pc += 1 + get_opargs(op);
+    }
+    return -1;
+}
+
+bool inline_call(struct forthvm *vm, data entry)
+{
+    data start = vm->dict[entry];
+    // undefined words are bound late, and the word being defined is
+    // recursive
+    if (!(vm->opts & OPT_INLINE) || vm->ready || start < 0 ||
+        entry == vm->lastword || (vm->dictflags[entry] & WORD_NOINLINE))
+        return false;
+    // native and compact words are copied from the cells they were made of
+    int op = vm_decode(vm, vm->code[start]);
+    if (op == OP_NATIVE || op == OP_COMPACT)
+        start = vm->dictcells[entry];
+    data end = body_end(vm, entry, start);
+    if (end < 0)
+        return false;
+    struct insnlist l;
+    insn_init(&l);
+    if (insn_decode(vm, &l, start, end) < 0) {
+        insn_free(&l);
+        return false;
+    }
+    // the final exit falls through to the caller, earlier ones jump there,
+    // and tail calls must return here again
+    l.buf[l.size - 1].dead = true;
+    for (int i = 0; i < l.size - 1; i++) {
+        if (l.buf[i].op == OP_TICK)
+            l.buf[i].dead = true;
+        if (l.buf[i].op == OP_TAILCALL)
+            l.buf[i].op = OP_CALL;
+        if (l.buf[i].op == OP_EXIT) {
+            l.buf[i].op = OP_JMP;
+            l.buf[i].arg[0] = l.size;
+        }
+    }
+    // nothing is fused across the copy, so its cells can be found again
+    vm_mark_label(vm);
+    data from = vm->codesz;
+    insn_encode(vm, &l);
+    insn_free(&l);
+    // a copy has a cell of its own for its call, apart from a jump past it
+    if (vm->codesz == from)
+        vm_emit_opcode(vm, OP_NOP);
+    vm_mark_label(vm);
+    if (vm->ncopies >= vm->copycap) {
+        vm->copycap = vm->copycap < 16 ? 16 : vm->copycap * 2;
+        vm->copies =
+            realloc(vm->copies, sizeof(struct inlinecopy) * vm->copycap);
+    }
+    vm->copies[vm->ncopies++] = (struct inlinecopy){entry, from, vm->codesz};
+    return true;
+}
+
+static void add_inliner(struct forthvm *vm, data entry, data caller)
+{
+    data head = vm->dictinline[entry];
+    if (head >= 0 && vm->inlines[head].caller == caller)
+        return;
+    data i = vm->freeinline;
+    if (i >= 0) {
+        vm->freeinline = vm->inlines[i].next;
+    } else {
+        if (vm->ninlines >= vm->inlinecap) {
+            vm->inlinecap = vm->inlinecap < 64 ? 64 : vm->inlinecap * 2;
+            vm->inlines = realloc(vm->inlines, sizeof(struct inlinesite) *
+                                                   vm->inlinecap);
+        }
+        i = vm->ninlines++;
+    }
+    vm->inlines[i] = (struct inlinesite){caller, head};
+    vm->dictinline[entry] = i;
+}
+
+void inline_finish(struct forthvm *vm, data entry)
+{
+    data n = vm->ncopies;
+    vm->ncopies = 0;
+    data k = vm->dictform[entry];
+    if (k >= 0)
+        insn_free(&vm->forms[k]);
+    if (n == 0)
+        return;
+    struct insnlist l;
+    insn_init(&l);
+    if (insn_decode(vm, &l, vm->dict[entry], vm->dictend[entry]) < 0) {
+        insn_free(&l);
+        return;
+    }
+    data *pos = malloc(sizeof(data) * (l.size + 1));
+    pos[0] = vm->dict[entry];
+    for (int i = 0; i < l.size; i++)
+        pos[i + 1] = pos[i] + 1 + get_opargs(l.buf[i].op);
+    int i = l.size;
+    for (data c = n - 1; c >= 0; c--) {
+        struct inlinecopy *cp = &vm->copies[c];
+        while (pos[i] > cp->to)
+            i--;
+        int to = i;
+        while (pos[i] > cp->from)
+            i--;
+        l.buf[i] = (struct insn){OP_CALL, {cp->entry, -1}};
+        for (int j = i + 1; j < to; j++)
+            l.buf[j].dead = true;
+        add_inliner(vm, cp->entry, entry);
+    }
+    free(pos);
+    if (k < 0) {
+        if (vm->nforms >= vm->formcap) {
+            vm->formcap = vm->formcap < 16 ? 16 : vm->formcap * 2;
+            vm->forms =
+                realloc(vm->forms, sizeof(struct insnlist) * vm->formcap);
+        }
+        k = vm->nforms++;
+        vm->dictform[entry] = k;
+    }
+    vm->forms[k] = l;
+}
+
+// compile entry again from its form, calling the words it had copies of
+static void recompile(struct forthvm *vm, data entry)
+{
+    struct insnlist *l = &vm->forms[vm->dictform[entry]];
+    // a memoized word calls its body from the cell after OP_MEMO k OP_CALL
+    // entry of its stub
+    bool memo = vm->dictflags[entry] & WORD_MEMO;
+    data stub = vm->dict[entry];
+    data start = memo ? vm->code[stub + 4] : stub;
+    data end = vm->dictend[entry];
+    for (int i = 0; i < l->size; i++) {
+        if (l->buf[i].op == OP_TICK)
+            l->buf[i].dead = true;
+    }
+    data over = vm_skip_begin(vm);
+    vm_define(vm, entry, vm->codesz);
+    insn_encode(vm, l);
+    insn_free(l);
+    vm_mark_label(vm);
+    tier_compile(vm, entry);
+    vm_skip_end(vm, over);
+    data body = vm->dict[entry];
+    if (memo) {
+        vm->code[stub + 4] = body;
+        vm_define(vm, entry, stub);
+    }
+    // tokens taken before go to the new body, unless the old one is too
+    // short for a jump
+    if (end - start >= 2) {
+        vm->code[start] = vm->optab[OP_JMP];
+        vm->code[start + 1] = body;
+    }
+}
+
+void inline_redefine(struct forthvm *vm, data entry)
+{
+    data i = vm->dictinline[entry];
+    vm->dictinline[entry] = -1;
+    while (i >= 0) {
+        data caller = vm->inlines[i].caller;
+        data next = vm->inlines[i].next;
+        vm->inlines[i].next = vm->freeinline;
+        vm->freeinline = i;
+        i = next;
+        data k = vm->dictform[caller];
+        if (k < 0 || vm->forms[k].size == 0)
+            continue;
+        recompile(vm, caller);
+        // and the words the caller was copied into in turn
+        inline_redefine(vm, caller);
+    }
+}
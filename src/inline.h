@@ -0,0 +1,37 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_INLINE_H_
+#define REINFORTH_INLINE_H_
+
+#include <stdbool.h>
+
+#include "types.h"
+
+struct forthvm;
+
+// copy the body of a short word instead of emitting a call to it, returns
+// false if the call must be emitted
+bool inline_call(struct forthvm *vm, data entry);
+// keep the code of the word just defined with calls in place of the copies
+// it has, for inline_redefine
+void inline_finish(struct forthvm *vm, data entry);
+// compile the words that have copies of entry again with calls to it, once
+// entry is defined again
+void inline_redefine(struct forthvm *vm, data entry);
+
+#endif
@@ -0,0 +1,216 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "insn.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+
+void insn_init(struct insnlist *l) { *l = (struct insnlist){0}; }
+
+void insn_free(struct insnlist *l)
+{
+    free(l->buf);
+    insn_init(l);
+}
+
+struct insn *insn_append(struct insnlist *l, enum opcode op)
+{
+    if (l->size >= l->cap) {
+        l->cap = l->cap < 16 ? 16 : l->cap * 2;
+        l->buf = realloc(l->buf, sizeof(struct insn) * l->cap);
+    }
+    struct insn *in = &l->buf[l->size];
+    *in = (struct insn){op};
+    l->size++;
+    return in;
+}
+
+// open n nops at index at, jumps to at land on the first of them and the
+// instruction that was there follows them
+struct insn *insn_insert(struct insnlist *l, int at, int n)
+{
+    for (int i = 0; i < n; i++)
+        insn_append(l, OP_NOP);
+    memmove(&l->buf[at + n], &l->buf[at],
+            sizeof(struct insn) * (l->size - n - at));
+    for (int i = 0; i < l->size; i++) {
+        data *t = insn_target(&l->buf[i]);
+        if (i >= at && i < at + n)
+            l->buf[i] = (struct insn){OP_NOP};
+        else if (t != NULL && *t > at)
+            *t += n;
+    }
+    return &l->buf[at];
+}
+
+data *insn_target(struct insn *in)
+{
+    if (!is_jump(in->op))
+        return NULL;
+    return &in->arg[get_opargs(in->op) - 1];
+}
+
+// index of the first live instruction after i, or size
+int insn_next(struct insnlist *l, int i)
+{
+    i++;
+    while (i < l->size && l->buf[i].dead)
+        i++;
+    return i;
+}
+
+// decode code[start, end), fails on cells that are not opcodes and on jumps
+// leaving the range or landing inside an instruction
+int insn_decode(struct forthvm *vm, struct insnlist *l, data start, data end)
+{
+    int *index = malloc(sizeof(int) * (end - start + 1));
+    for (data i = 0; i <= end - start; i++)
+        index[i] = -1;
+    data pc = start;
+    while (pc < end) {
+        int op = vm_decode(vm, vm->code[pc]);
+        if (op < 0 || pc + get_opargs(op) >= end) {
+            free(index);
+            return -1;
+        }
+        index[pc - start] = l->size;
+        struct insn *in = insn_append(l, op);
+        for (int j = 0; j < get_opargs(op); j++) {
+            in->arg[j] = vm->code[pc + 1 + j];
+        }
+        pc += 1 + get_opargs(op);
+    }
+    index[end - start] = l->size;
+    for (int i = 0; i < l->size; i++) {
+        data *t = insn_target(&l->buf[i]);
+        if (t == NULL)
+            continue;
+        if (*t < start || *t > end || index[*t - start] < 0) {
+            free(index);
+            return -1;
+        }
+        *t = index[*t - start];
+    }
+    free(index);
+    return 0;
+}
+
+struct fixup {
+    data pos;
+    data target;
+};
+
+// emit the live instructions at the end of code, superinstructions are
+// formed again except across branch targets, including one at the end
+void insn_encode(struct forthvm *vm, struct insnlist *l)
+{
+    bool *label = calloc(l->size + 1, sizeof(bool));
+    data *newpos = malloc(sizeof(data) * (l->size + 1));
+    struct fixup *fixups = malloc(sizeof(struct fixup) * (l->size + 1));
+    int nfixups = 0;
+    for (int i = 0; i < l->size; i++) {
+        data *t = insn_target(&l->buf[i]);
+        if (!l->buf[i].dead && t != NULL)
+            label[*t] = true;
+    }
+    for (int i = 0; i < l->size; i++) {
+        struct insn *in = &l->buf[i];
+        newpos[i] = vm->codesz;
+        if (label[i])
+            vm_mark_label(vm);
+        if (in->dead)
+            continue;
+        // no fusion rule starts with a jump, so a fixup is never moved by
+        // the fusion of a later instruction
+        if (in->op == OP_CALL || in->op == OP_TAILCALL) {
+            vm_emit_call(vm, in->op, in->arg[0]);
+            continue;
+        }
+        vm_emit_opcode(vm, in->op);
+        int nargs = get_opargs(in->op);
+        for (int j = 0; j < nargs; j++) {
+            if (is_jump(in->op) && j == nargs - 1) {
+                fixups[nfixups++] = (struct fixup){vm->codesz, in->arg[j]};
+                vm_emit_data(vm, -1);
+            } else {
+                vm_emit_data(vm, in->arg[j]);
+            }
+        }
+    }
+    newpos[l->size] = vm->codesz;
+    if (label[l->size])
+        vm_mark_label(vm);
+    for (int i = 0; i < nfixups; i++) {
+        vm->code[fixups[i].pos] = newpos[fixups[i].target];
+    }
+    free(label);
+    free(newpos);
+    free(fixups);
+}
+
+// return stack cells an instruction needs and pushes
+static void rs_use(enum opcode op, int *need, int *push)
+{
+    *need = 0;
+    *push = 0;
+    switch (op) {
+    case OP_D2R:
+        *push = 1;
+        break;
+    case OP_R2D:
+        *need = 1;
+        *push = -1;
+        break;
+    case OP_RAT:
+    case OP_I:
+    case OP_LOOP:
+    case OP_PLUSLOOP:
+        *need = 1;
+        break;
+    case OP_II:
+    case OP_DO:
+        *need = 2;
+        break;
+    case OP_UNLOOP:
+        *need = 2;
+        *push = -2;
+        break;
+    case OP_J:
+        *need = 3;
+        break;
+    case OP_RPICK:
+        *need = INT32_MAX;
+        break;
+    default:
+        break;
+    }
+}
+
+bool insn_rs_balanced(struct insnlist *l)
+{
+    int depth = 0, need, push;
+    for (int i = 0; i < l->size; i++) {
+        rs_use(l->buf[i].op, &need, &push);
+        if (depth < need)
+            return false;
+        depth += push;
+    }
+    return depth == 0;
+}
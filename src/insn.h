@@ -0,0 +1,55 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_INSN_H_
+#define REINFORTH_INSN_H_
+
+#include <stdbool.h>
+
+#include "opcode.h"
+#include "types.h"
+
+struct insn {
+    enum opcode op;
+    data arg[2];
+    bool dead;
+};
+
+// a decoded piece of code, the branch target of a jump is kept as the index
+// of the target instruction so that instructions can be removed or inserted
+// before encoding it again, index size stands for the end of the piece
+struct insnlist {
+    struct insn *buf;
+    int size;
+    int cap;
+};
+
+struct forthvm;
+
+void insn_init(struct insnlist *l);
+void insn_free(struct insnlist *l);
+struct insn *insn_append(struct insnlist *l, enum opcode op);
+struct insn *insn_insert(struct insnlist *l, int at, int n);
+int insn_decode(struct forthvm *vm, struct insnlist *l, data start, data end);
+void insn_encode(struct forthvm *vm, struct insnlist *l);
+data *insn_target(struct insn *in);
+int insn_next(struct insnlist *l, int i);
+// whether the code only reads return stack cells it pushed itself and pops
+// them all, code generators keeping return addresses of their own need it
+bool insn_rs_balanced(struct insnlist *l);
+
+#endif
@@ -0,0 +1,1266 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && CELL_BITS == 64
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "insn.h"
+#include "vm.h"
+
+// Native code keeps the vm in r12, a pointer to the top cell of the data
+// stack in rbx and to the top cell of the return stack in r13. Stacks stay
+// in memory, so the guard pages catch overflow and underflow exactly as in
+// the interpreters.
+//
+// Words call each other with call and ret, and also bump r13 so the return
+// stack depth, and its overflow, match the interpreters. They run on a
+// stack of their own, big enough that the return stack guard page trips
+// first. Anything without a template calls its opfunc after writing rbx
+// and r13 back. Errors unwind from there straight to vm_run, which
+// restores the C registers and stack.
+//
+// In JIT_CALLS mode nothing is cached, dsp and rsp stay in the vm and most
+// instructions are a call to their opfunc. Literals, branches, loops and
+// calls between words are still generated inline.
+
+enum reg {
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+};
+
+// condition codes of jcc, setcc and cmovcc
+enum cond {
+    CC_B = 0x2,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_S = 0x8,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+    CC_G = 0xf,
+};
+
+#define OFF(field) ((int32_t)offsetof(struct forthvm, field))
+
+// room for native frames and the C frames of handlers they call
+#define JIT_STACK_EXTRA (8 << 20)
+#define JIT_ARENA_CHUNK (1 << 20)
+
+struct jit {
+    // stack tops live in rbx and r13, false in JIT_CALLS mode
+    bool cached;
+    uint8_t *arena;
+    size_t arenacap;
+    size_t arenasz;
+    // mapping of the native stack, its lowest page is a guard page
+    char *stack;
+    size_t stacksz;
+    void (*enter)(struct forthvm *vm, void *fn);
+};
+
+struct asmbuf {
+    uint8_t *p;
+    size_t len;
+    size_t cap;
+};
+
+static void emit8(struct asmbuf *b, uint8_t x)
+{
+    if (b->len >= b->cap) {
+        b->cap = b->cap < 256 ? 256 : b->cap * 2;
+        b->p = realloc(b->p, b->cap);
+    }
+    b->p[b->len++] = x;
+}
+
+static void emit32(struct asmbuf *b, int32_t x)
+{
+    for (int i = 0; i < 4; i++)
+        emit8(b, (uint32_t)x >> (i * 8));
+}
+
+static void emit64(struct asmbuf *b, int64_t x)
+{
+    for (int i = 0; i < 8; i++)
+        emit8(b, (uint64_t)x >> (i * 8));
+}
+
+static bool fits32(data x) { return x >= INT32_MIN && x <= INT32_MAX; }
+
+static void rex(struct asmbuf *b, bool w, int reg, int rm)
+{
+    uint8_t r = 0x40 | (w ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+    if (r != 0x40)
+        emit8(b, r);
+}
+
+static void opcode(struct asmbuf *b, int op)
+{
+    if (op > 0xff)
+        emit8(b, op >> 8);
+    emit8(b, op);
+}
+
+// op with a register and [base + disp] operand, reg may be an opcode digit
+static void mem(struct asmbuf *b, bool w, int op, int reg, int base,
+                int32_t disp)
+{
+    int mod = 2;
+    if (disp == 0 && (base & 7) != RBP)
+        mod = 0;
+    else if (disp >= -128 && disp < 128)
+        mod = 1;
+    rex(b, w, reg, base);
+    opcode(b, op);
+    emit8(b, mod << 6 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP)
+        emit8(b, 0x24);
+    if (mod == 1)
+        emit8(b, disp);
+    else if (mod == 2)
+        emit32(b, disp);
+}
+
+// op with two register operands, reg may be an opcode digit
+static void rr(struct asmbuf *b, bool w, int op, int reg, int rm)
+{
+    rex(b, w, reg, rm);
+    opcode(b, op);
+    emit8(b, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void load(struct asmbuf *b, int reg, int base, int32_t disp)
+{
+    mem(b, true, 0x8b, reg, base, disp);
+}
+
+static void store(struct asmbuf *b, int base, int32_t disp, int reg)
+{
+    mem(b, true, 0x89, reg, base, disp);
+}
+
+static void movr(struct asmbuf *b, int dst, int src)
+{
+    rr(b, true, 0x89, src, dst);
+}
+
+static void movi(struct asmbuf *b, int reg, data imm)
+{
+    if (fits32(imm)) {
+        rr(b, true, 0xc7, 0, reg);
+        emit32(b, imm);
+        return;
+    }
+    rex(b, true, 0, reg);
+    emit8(b, 0xb8 + (reg & 7));
+    emit64(b, imm);
+}
+
+static void addi(struct asmbuf *b, int reg, int8_t imm)
+{
+    rr(b, true, 0x83, 0, reg);
+    emit8(b, imm);
+}
+
+static void push(struct asmbuf *b, int reg)
+{
+    rex(b, false, 0, reg);
+    emit8(b, 0x50 + (reg & 7));
+}
+
+static void pop(struct asmbuf *b, int reg)
+{
+    rex(b, false, 0, reg);
+    emit8(b, 0x58 + (reg & 7));
+}
+
+// jumps return the position of their rel32 for patch
+static size_t jcc(struct asmbuf *b, enum cond cc)
+{
+    emit8(b, 0x0f);
+    emit8(b, 0x80 | cc);
+    emit32(b, 0);
+    return b->len - 4;
+}
+
+static size_t jmp(struct asmbuf *b)
+{
+    emit8(b, 0xe9);
+    emit32(b, 0);
+    return b->len - 4;
+}
+
+static void patch(struct asmbuf *b, size_t pos, size_t target)
+{
+    int32_t rel = target - (pos + 4);
+    memcpy(b->p + pos, &rel, 4);
+}
+
+// push rax on the data stack
+static void dpush(struct asmbuf *b)
+{
+    addi(b, RBX, 8);
+    store(b, RBX, 0, RAX);
+}
+
+// write rbx and r13 back to dsp and rsp
+static void spill(struct asmbuf *b)
+{
+    movr(b, RAX, RBX);
+    mem(b, true, 0x2b, RAX, R12, OFF(ds));
+    rr(b, true, 0xc1, 7, RAX);
+    emit8(b, 3);
+    store(b, R12, OFF(dsp), RAX);
+    movr(b, RAX, R13);
+    mem(b, true, 0x2b, RAX, R12, OFF(rs));
+    rr(b, true, 0xc1, 7, RAX);
+    emit8(b, 3);
+    store(b, R12, OFF(rsp), RAX);
+}
+
+static void fill(struct asmbuf *b)
+{
+    load(b, RAX, R12, OFF(dsp));
+    rr(b, true, 0xc1, 4, RAX);
+    emit8(b, 3);
+    mem(b, true, 0x03, RAX, R12, OFF(ds));
+    movr(b, RBX, RAX);
+    load(b, RAX, R12, OFF(rsp));
+    rr(b, true, 0xc1, 4, RAX);
+    emit8(b, 3);
+    mem(b, true, 0x03, RAX, R12, OFF(rs));
+    movr(b, R13, RAX);
+}
+
+// rax = &base[ptr] for the stack pointer and base fields at the offsets
+static void cell(struct asmbuf *b, int32_t ptr, int32_t base)
+{
+    load(b, RAX, R12, ptr);
+    rr(b, true, 0xc1, 4, RAX);
+    emit8(b, 3);
+    mem(b, true, 0x03, RAX, R12, base);
+}
+
+// rax = -1 if cc holds else 0
+static void setbool(struct asmbuf *b, enum cond cc)
+{
+    rr(b, false, 0x0f90 | cc, 0, RAX);
+    rr(b, false, 0x0fb6, RAX, RAX);
+    rr(b, true, 0xf7, 3, RAX);
+}
+
+static void *arena_put(struct jit *j, struct asmbuf *b)
+{
+    if (j->arenasz + b->len > j->arenacap) {
+        size_t cap = b->len > JIT_ARENA_CHUNK ? b->len : JIT_ARENA_CHUNK;
+        void *p = mmap(NULL, cap, PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        j->arena = p;
+        j->arenacap = cap;
+        j->arenasz = 0;
+    }
+    void *p = j->arena + j->arenasz;
+    memcpy(p, b->p, b->len);
+    // keep entry points aligned
+    j->arenasz = (j->arenasz + b->len + 15) & ~(size_t)15;
+    return p;
+}
+
+// enter(vm, fn) saves the C callee-saved registers, switches to the native
+// stack unless already on it and calls fn
+static int build_enter(struct jit *j)
+{
+    struct asmbuf b = {0};
+    char *lo = j->stack + sysconf(_SC_PAGESIZE);
+    char *hi = j->stack + j->stacksz;
+    push(&b, RBP);
+    push(&b, RBX);
+    push(&b, R12);
+    push(&b, R13);
+    push(&b, R14);
+    push(&b, R15);
+    movr(&b, R12, RDI);
+    movr(&b, RBP, RSP);
+    movi(&b, RAX, (data)lo);
+    rr(&b, true, 0x39, RAX, RSP);
+    size_t below = jcc(&b, CC_B);
+    movi(&b, RAX, (data)hi);
+    rr(&b, true, 0x39, RAX, RSP);
+    size_t inside = jcc(&b, CC_B);
+    patch(&b, below, b.len);
+    movi(&b, RAX, (data)hi);
+    movr(&b, RSP, RAX);
+    patch(&b, inside, b.len);
+    rr(&b, true, 0x83, 4, RSP);
+    emit8(&b, 0xf0);
+    if (j->cached)
+        fill(&b);
+    rr(&b, false, 0xff, 2, RSI);
+    if (j->cached)
+        spill(&b);
+    movr(&b, RSP, RBP);
+    pop(&b, R15);
+    pop(&b, R14);
+    pop(&b, R13);
+    pop(&b, R12);
+    pop(&b, RBX);
+    pop(&b, RBP);
+    emit8(&b, 0xc3);
+    uint8_t *p = arena_put(j, &b);
+    free(b.p);
+    if (p == NULL)
+        return -1;
+    j->enter = (void (*)(struct forthvm *, void *))p;
+    return 0;
+}
+
+static int jit_init(struct forthvm *vm)
+{
+    struct jit *j = calloc(1, sizeof(struct jit));
+    j->cached = vm->jitmode == JIT_TEMPLATE;
+    size_t page = sysconf(_SC_PAGESIZE);
+    j->stacksz = vm->rscap * 16 + JIT_STACK_EXTRA;
+    j->stacksz = (j->stacksz + page - 1) / page * page + page;
+    j->stack = mmap(NULL, j->stacksz, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (j->stack == MAP_FAILED) {
+        free(j);
+        return -1;
+    }
+    mprotect(j->stack, page, PROT_NONE);
+    if (build_enter(j) < 0) {
+        munmap(j->stack, j->stacksz);
+        free(j);
+        return -1;
+    }
+    // interpreted callees return on it
+    vm_reserve_halt(vm);
+    vm->jit = j;
+    return 0;
+}
+
+// a jump to patch, target is an instruction index
+struct fixup {
+    size_t pos;
+    int target;
+};
+
+struct jitctx {
+    struct forthvm *vm;
+    struct asmbuf b;
+    struct fixup *fixups;
+    int nfixups;
+    int cap;
+};
+
+static void add_fixup(struct jitctx *c, size_t pos, int target)
+{
+    if (c->nfixups >= c->cap) {
+        c->cap = c->cap < 16 ? 16 : c->cap * 2;
+        c->fixups = realloc(c->fixups, sizeof(struct fixup) * c->cap);
+    }
+    c->fixups[c->nfixups++] = (struct fixup){pos, target};
+}
+
+static void ret(struct asmbuf *b)
+{
+    addi(b, RSP, 8);
+    emit8(b, 0xc3);
+}
+
+// call f(vm, arg) with the stacks written back
+static void ccall(struct jitctx *c, void *f, data arg)
+{
+    struct asmbuf *b = &c->b;
+    if (c->vm->jit->cached)
+        spill(b);
+    movr(b, RDI, R12);
+    movi(b, RSI, arg);
+    movi(b, RAX, (data)f);
+    rr(b, false, 0xff, 2, RAX);
+    if (c->vm->jit->cached)
+        fill(b);
+}
+
+// bump the return stack depth around a native call to rax
+static void rpush(struct jitctx *c)
+{
+    struct asmbuf *b = &c->b;
+    if (c->vm->jit->cached) {
+        addi(b, R13, 8);
+        store(b, R13, 0, RAX);
+        return;
+    }
+    movr(b, RSI, RAX);
+    mem(b, true, 0xff, 0, R12, OFF(rsp));
+    cell(b, OFF(rsp), OFF(rs));
+    store(b, RAX, 0, RAX);
+    movr(b, RAX, RSI);
+}
+
+static void rpop(struct jitctx *c)
+{
+    if (c->vm->jit->cached)
+        addi(&c->b, R13, -8);
+    else
+        mem(&c->b, true, 0xff, 1, R12, OFF(rsp));
+}
+
+// rax = code + rax
+static void code_ptr(struct asmbuf *b)
+{
+    rr(b, true, 0xc1, 4, RAX);
+    emit8(b, 3);
+    mem(b, true, 0x03, RAX, R12, OFF(code));
+}
+
+// calls look the word up each time since it may be redefined, words with
+// native code are called directly and the rest go through the interpreter.
+// A deferred word is followed to its target while it is still a jump.
+static void call(struct jitctx *c, data entry, bool tail)
+{
+    struct asmbuf *b = &c->b;
+    load(b, RAX, R12, OFF(dict));
+    load(b, RAX, RAX, entry * sizeof(data));
+    rr(b, true, 0x85, RAX, RAX);
+    size_t undefined = jcc(b, CC_S);
+    code_ptr(b);
+    if (c->vm->dictflags[entry] & WORD_DEFER) {
+        movi(b, RDX, c->vm->optab[OP_JMP]);
+        mem(b, true, 0x39, RDX, RAX, 0);
+        size_t plain = jcc(b, CC_NE);
+        load(b, RAX, RAX, sizeof(data));
+        code_ptr(b);
+        patch(b, plain, b->len);
+    }
+    movi(b, RDX, c->vm->optab[OP_NATIVE]);
+    mem(b, true, 0x39, RDX, RAX, 0);
+    size_t interpreted = jcc(b, CC_NE);
+    if (tail) {
+        addi(b, RSP, 8);
+        mem(b, false, 0xff, 4, RAX, sizeof(data));
+    } else {
+        rpush(c);
+        mem(b, false, 0xff, 2, RAX, sizeof(data));
+        rpop(c);
+    }
+    size_t done = tail ? 0 : jmp(b);
+    patch(b, undefined, b->len);
+    patch(b, interpreted, b->len);
+    ccall(c, vm_call, entry);
+    if (tail)
+        ret(b);
+    else
+        patch(b, done, b->len);
+}
+
+static void execute_xt(struct forthvm *vm) { vm_call_at(vm, vm_pop_ds(vm)); }
+
+// the token is the address of the code to run, native or not as in call
+static void execute(struct jitctx *c)
+{
+    struct asmbuf *b = &c->b;
+    bool cached = c->vm->jit->cached;
+    if (cached) {
+        load(b, RAX, RBX, 0);
+    } else {
+        cell(b, OFF(dsp), OFF(ds));
+        load(b, RAX, RAX, 0);
+    }
+    code_ptr(b);
+    movi(b, RDX, c->vm->optab[OP_NATIVE]);
+    mem(b, true, 0x39, RDX, RAX, 0);
+    size_t interpreted = jcc(b, CC_NE);
+    if (cached)
+        addi(b, RBX, -8);
+    else
+        mem(b, true, 0xff, 1, R12, OFF(dsp));
+    rpush(c);
+    mem(b, false, 0xff, 2, RAX, sizeof(data));
+    rpop(c);
+    size_t done = jmp(b);
+    patch(b, interpreted, b->len);
+    ccall(c, execute_xt, 0);
+    patch(b, done, b->len);
+}
+
+// native call to code already generated
+static void native(struct jitctx *c, data fn)
+{
+    struct asmbuf *b = &c->b;
+    rpush(c);
+    movi(b, RAX, fn);
+    rr(b, false, 0xff, 2, RAX);
+    rpop(c);
+}
+
+static void underflow(struct forthvm *vm, data n)
+{
+    vm_error(vm, "no enough element on data stack");
+}
+
+// OP_NEEDS with the depth in rax
+static void needs(struct jitctx *c, data n)
+{
+    struct asmbuf *b = &c->b;
+    rr(b, true, 0x81, 7, RAX);
+    emit32(b, n);
+    size_t ok = jcc(b, CC_GE);
+    ccall(c, underflow, n);
+    patch(b, ok, b->len);
+}
+
+// instructions always left to their opfunc, they may finish the vm or grow
+// the code
+static bool can_finish(enum opcode op)
+{
+    switch (op) {
+    case OP_DOT:
+    case OP_CREATE:
+    case OP_BYE:
+    case OP_ALLOT:
+    case OP_ALLOCATE:
+    case OP_RESIZE:
+    case OP_FREE:
+    case OP_COMMA:
+    case OP_CR:
+    case OP_PRINT:
+    case OP_EMIT:
+    case OP_DUMP:
+    case OP_RDUMP:
+    case OP_QUOTE:
+    case OP_DEFER:
+    case OP_IS:
+    case OP_HEAPSIZE:
+    case OP_FUSIONS:
+    case OP_CODESIZE:
+    case OP_STACKEFFECT:
+    case OP_TIERS:
+    case OP_RELAYOUT:
+    case OP_MEMOS:
+    case OP_PICK:
+    case OP_RPICK:
+    case OP_ASSERT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// SHLI or SHRI on the cell at [top]
+static void shift(struct asmbuf *b, struct insn *in, int top)
+{
+    if (in->op == OP_SHLI) {
+        mem(b, true, 0xc1, 4, top, 0);
+        emit8(b, in->arg[0]);
+        return;
+    }
+    // bias negative values by 2^n - 1 to round toward zero
+    load(b, RDX, top, 0);
+    movr(b, RCX, RDX);
+    rr(b, true, 0xc1, 7, RCX);
+    emit8(b, 63);
+    rr(b, true, 0xc1, 5, RCX);
+    emit8(b, 64 - in->arg[0]);
+    rr(b, true, 0x01, RCX, RDX);
+    rr(b, true, 0xc1, 7, RDX);
+    emit8(b, in->arg[0]);
+    store(b, top, 0, RDX);
+}
+
+static void binop(struct asmbuf *b, int op)
+{
+    load(b, RAX, RBX, 0);
+    addi(b, RBX, -8);
+    mem(b, true, op, RAX, RBX, 0);
+}
+
+static void compare(struct asmbuf *b, enum cond cc)
+{
+    load(b, RAX, RBX, 0);
+    addi(b, RBX, -8);
+    load(b, RCX, RBX, 0);
+    rr(b, true, 0x39, RAX, RCX);
+    setbool(b, cc);
+    store(b, RBX, 0, RAX);
+}
+
+static void divide(struct asmbuf *b, int result)
+{
+    load(b, RCX, RBX, 0);
+    addi(b, RBX, -8);
+    load(b, RAX, RBX, 0);
+    emit8(b, 0x48);
+    emit8(b, 0x99);
+    rr(b, true, 0xf7, 7, RCX);
+    store(b, RBX, 0, result);
+}
+
+static void logic(struct asmbuf *b, int op)
+{
+    load(b, RAX, RBX, 0);
+    addi(b, RBX, -8);
+    load(b, RCX, RBX, 0);
+    rr(b, true, 0x85, RAX, RAX);
+    rr(b, false, 0x0f95, 0, RAX);
+    rr(b, true, 0x85, RCX, RCX);
+    rr(b, false, 0x0f95, 0, RCX);
+    rr(b, false, op, RCX, RAX);
+    rr(b, false, 0x0fb6, RAX, RAX);
+    rr(b, true, 0xf7, 3, RAX);
+    store(b, RBX, 0, RAX);
+}
+
+// fused compare and jump, taken when cond is false
+static void cmpjump(struct jitctx *c, struct insn *in, enum cond notcc,
+                    bool imm)
+{
+    struct asmbuf *b = &c->b;
+    if (imm) {
+        load(b, RAX, RBX, 0);
+        addi(b, RBX, -8);
+        if (fits32(in->arg[0])) {
+            rr(b, true, 0x81, 7, RAX);
+            emit32(b, in->arg[0]);
+        } else {
+            movi(b, RCX, in->arg[0]);
+            rr(b, true, 0x39, RCX, RAX);
+        }
+        add_fixup(c, jcc(b, notcc), in->arg[1]);
+        return;
+    }
+    load(b, RAX, RBX, 0);
+    load(b, RCX, RBX, -8);
+    addi(b, RBX, -16);
+    rr(b, true, 0x39, RAX, RCX);
+    add_fixup(c, jcc(b, notcc), in->arg[0]);
+}
+
+// the n casej entries at e on rax, compared by halves, values without an
+// entry jump to miss[]
+static void case_search(struct jitctx *c, struct insn *e, int n, size_t *miss,
+                        int *nmiss)
+{
+    struct asmbuf *b = &c->b;
+    if (n == 0) {
+        miss[(*nmiss)++] = jmp(b);
+        return;
+    }
+    int mid = n / 2;
+    data v = e[mid].arg[0];
+    if (fits32(v)) {
+        rr(b, true, 0x81, 7, RAX);
+        emit32(b, v);
+    } else {
+        movi(b, RCX, v);
+        rr(b, true, 0x3b, RAX, RCX);
+    }
+    add_fixup(c, jcc(b, CC_E), e[mid].arg[1]);
+    size_t less = jcc(b, CC_L);
+    case_search(c, e + mid + 1, n - mid - 1, miss, nmiss);
+    patch(b, less, b->len);
+    case_search(c, e, mid, miss, nmiss);
+}
+
+// jtab and btab with the top of the stack in rax, the entries follow in and
+// translate to nothing, so a miss goes on past them
+static void case_table(struct jitctx *c, struct insn *in)
+{
+    int n = in->arg[0];
+    size_t *miss = malloc(sizeof(size_t) * (n + 1));
+    int nmiss = 0;
+    case_search(c, in + 1, n, miss, &nmiss);
+    for (int i = 0; i < nmiss; i++)
+        patch(&c->b, miss[i], c->b.len);
+    free(miss);
+}
+
+static int translate(struct jitctx *c, struct insn *in)
+{
+    struct asmbuf *b = &c->b;
+    switch (in->op) {
+    case OP_PUSH:
+        addi(b, RBX, 8);
+        if (fits32(in->arg[0])) {
+            mem(b, true, 0xc7, 0, RBX, 0);
+            emit32(b, in->arg[0]);
+        } else {
+            movi(b, RAX, in->arg[0]);
+            store(b, RBX, 0, RAX);
+        }
+        break;
+    case OP_DUP:
+        load(b, RAX, RBX, 0);
+        dpush(b);
+        break;
+    case OP_DROP:
+        load(b, RAX, RBX, 0);
+        addi(b, RBX, -8);
+        break;
+    case OP_SWAP:
+        load(b, RAX, RBX, 0);
+        load(b, RCX, RBX, -8);
+        store(b, RBX, 0, RCX);
+        store(b, RBX, -8, RAX);
+        break;
+    case OP_OVER:
+        load(b, RAX, RBX, -8);
+        dpush(b);
+        break;
+    case OP_ROT:
+        load(b, RAX, RBX, -16);
+        load(b, RCX, RBX, -8);
+        load(b, RDX, RBX, 0);
+        store(b, RBX, -16, RCX);
+        store(b, RBX, -8, RDX);
+        store(b, RBX, 0, RAX);
+        break;
+    case OP_2DUP:
+        load(b, RAX, RBX, -8);
+        load(b, RCX, RBX, 0);
+        addi(b, RBX, 16);
+        store(b, RBX, -8, RAX);
+        store(b, RBX, 0, RCX);
+        break;
+    case OP_ADD:
+        binop(b, 0x01);
+        break;
+    case OP_MINUS:
+        binop(b, 0x29);
+        break;
+    case OP_BITAND:
+        binop(b, 0x21);
+        break;
+    case OP_BITOR:
+        binop(b, 0x09);
+        break;
+    case OP_XOR:
+        binop(b, 0x31);
+        break;
+    case OP_MUL:
+        load(b, RAX, RBX, 0);
+        addi(b, RBX, -8);
+        mem(b, true, 0x0faf, RAX, RBX, 0);
+        store(b, RBX, 0, RAX);
+        break;
+    case OP_DIV:
+        divide(b, RAX);
+        break;
+    case OP_MOD:
+        divide(b, RDX);
+        break;
+    case OP_DIVMOD:
+        load(b, RCX, RBX, 0);
+        load(b, RAX, RBX, -8);
+        emit8(b, 0x48);
+        emit8(b, 0x99);
+        rr(b, true, 0xf7, 7, RCX);
+        store(b, RBX, -8, RDX);
+        store(b, RBX, 0, RAX);
+        break;
+    case OP_MIN:
+    case OP_MAX:
+        load(b, RAX, RBX, 0);
+        addi(b, RBX, -8);
+        load(b, RCX, RBX, 0);
+        rr(b, true, 0x39, RAX, RCX);
+        rr(b, true, 0x0f40 | (in->op == OP_MIN ? CC_G : CC_L), RCX, RAX);
+        store(b, RBX, 0, RCX);
+        break;
+    case OP_EQ:
+        compare(b, CC_E);
+        break;
+    case OP_NEQ:
+        compare(b, CC_NE);
+        break;
+    case OP_LT:
+        compare(b, CC_L);
+        break;
+    case OP_GT:
+        compare(b, CC_G);
+        break;
+    case OP_LE:
+        compare(b, CC_LE);
+        break;
+    case OP_GE:
+        compare(b, CC_GE);
+        break;
+    case OP_AND:
+        logic(b, 0x20);
+        break;
+    case OP_OR:
+        logic(b, 0x08);
+        break;
+    case OP_NOT:
+        load(b, RAX, RBX, 0);
+        rr(b, true, 0x85, RAX, RAX);
+        setbool(b, CC_E);
+        store(b, RBX, 0, RAX);
+        break;
+    case OP_NEGATE:
+        mem(b, true, 0xf7, 3, RBX, 0);
+        break;
+    case OP_INVERT:
+        mem(b, true, 0xf7, 2, RBX, 0);
+        break;
+    case OP_CELLS:
+        mem(b, true, 0xc1, 4, RBX, 0);
+        emit8(b, 3);
+        break;
+    case OP_CHARS:
+        load(b, RAX, RBX, 0);
+        break;
+    case OP_AT:
+        load(b, RAX, RBX, 0);
+        load(b, RAX, RAX, 0);
+        store(b, RBX, 0, RAX);
+        break;
+    case OP_BANG:
+        load(b, RAX, RBX, 0);
+        load(b, RCX, RBX, -8);
+        store(b, RAX, 0, RCX);
+        addi(b, RBX, -16);
+        break;
+    case OP_ADDI:
+        if (fits32(in->arg[0])) {
+            mem(b, true, 0x81, 0, RBX, 0);
+            emit32(b, in->arg[0]);
+        } else {
+            movi(b, RAX, in->arg[0]);
+            mem(b, true, 0x01, RAX, RBX, 0);
+        }
+        break;
+    case OP_SHLI:
+    case OP_SHRI:
+        shift(b, in, RBX);
+        break;
+    case OP_PICKI:
+        load(b, RAX, RBX, -8 * in->arg[0]);
+        dpush(b);
+        break;
+    case OP_DEPTH:
+    case OP_NEEDS:
+        movr(b, RAX, RBX);
+        mem(b, true, 0x2b, RAX, R12, OFF(ds));
+        rr(b, true, 0xc1, 7, RAX);
+        emit8(b, 3);
+        if (in->op == OP_NEEDS)
+            needs(c, in->arg[0]);
+        else
+            dpush(b);
+        break;
+    case OP_HERE:
+        load(b, RAX, R12, OFF(heaptop));
+        dpush(b);
+        break;
+    case OP_D2R:
+        load(b, RAX, RBX, 0);
+        addi(b, RBX, -8);
+        addi(b, R13, 8);
+        store(b, R13, 0, RAX);
+        break;
+    case OP_R2D:
+        load(b, RAX, R13, 0);
+        addi(b, R13, -8);
+        dpush(b);
+        break;
+    case OP_RAT:
+    case OP_I:
+        load(b, RAX, R13, 0);
+        dpush(b);
+        break;
+    case OP_II:
+        load(b, RAX, R13, -8);
+        dpush(b);
+        break;
+    case OP_J:
+        load(b, RAX, R13, -16);
+        dpush(b);
+        break;
+    case OP_DO:
+        load(b, RAX, R13, 0);
+        mem(b, true, 0x3b, RAX, R13, -8);
+        add_fixup(c, jcc(b, CC_GE), in->arg[0]);
+        break;
+    case OP_LOOP:
+        mem(b, true, 0xff, 0, R13, 0);
+        load(b, RAX, R13, 0);
+        mem(b, true, 0x3b, RAX, R13, -8);
+        add_fixup(c, jcc(b, CC_L), in->arg[0]);
+        break;
+    case OP_PLUSLOOP:
+        load(b, RAX, RBX, 0);
+        addi(b, RBX, -8);
+        mem(b, true, 0x03, RAX, R13, 0);
+        store(b, R13, 0, RAX);
+        mem(b, true, 0x3b, RAX, R13, -8);
+        add_fixup(c, jcc(b, CC_L), in->arg[0]);
+        break;
+    case OP_UNLOOP:
+        addi(b, R13, -16);
+        break;
+    case OP_JMP:
+        add_fixup(c, jmp(b), in->arg[0]);
+        break;
+    case OP_JZ:
+    case OP_JNZ:
+        load(b, RAX, RBX, 0);
+        addi(b, RBX, -8);
+        rr(b, true, 0x85, RAX, RAX);
+        add_fixup(c, jcc(b, in->op == OP_JZ ? CC_E : CC_NE), in->arg[0]);
+        break;
+    case OP_DUPJZ:
+    case OP_DUPJNZ:
+        mem(b, true, 0x83, 7, RBX, 0);
+        emit8(b, 0);
+        add_fixup(c, jcc(b, in->op == OP_DUPJZ ? CC_E : CC_NE), in->arg[0]);
+        break;
+    case OP_EQJZ:
+        cmpjump(c, in, CC_NE, false);
+        break;
+    case OP_NEQJZ:
+        cmpjump(c, in, CC_E, false);
+        break;
+    case OP_LTJZ:
+        cmpjump(c, in, CC_GE, false);
+        break;
+    case OP_GTJZ:
+        cmpjump(c, in, CC_LE, false);
+        break;
+    case OP_LEJZ:
+        cmpjump(c, in, CC_G, false);
+        break;
+    case OP_GEJZ:
+        cmpjump(c, in, CC_L, false);
+        break;
+    case OP_EQIJZ:
+        cmpjump(c, in, CC_NE, true);
+        break;
+    case OP_NEQIJZ:
+        cmpjump(c, in, CC_E, true);
+        break;
+    case OP_LTIJZ:
+        cmpjump(c, in, CC_GE, true);
+        break;
+    case OP_GTIJZ:
+        cmpjump(c, in, CC_LE, true);
+        break;
+    case OP_LEIJZ:
+        cmpjump(c, in, CC_G, true);
+        break;
+    case OP_GEIJZ:
+        cmpjump(c, in, CC_L, true);
+        break;
+    case OP_EXIT:
+        ret(b);
+        break;
+    case OP_CALL:
+        call(c, in->arg[0], false);
+        break;
+    case OP_TAILCALL:
+        call(c, in->arg[0], true);
+        break;
+    case OP_EXECUTE:
+        execute(c);
+        break;
+    case OP_NATIVE:
+        native(c, in->arg[0]);
+        break;
+    case OP_CFUNC:
+        ccall(c, (void *)in->arg[0], 0);
+        break;
+    case OP_JTAB:
+    case OP_BTAB:
+        load(b, RAX, RBX, 0);
+        case_table(c, in);
+        break;
+    case OP_CASEJ:
+    case OP_NOP:
+        break;
+    default:
+        // the rest, like execute, need the interpreter's pc
+        if (!can_finish(in->op))
+            return -1;
+        ccall(c, get_opfunc(in->op), 0);
+        break;
+    }
+    return 0;
+}
+
+// condition computed by the compare of a fused compare and jump
+static enum opcode jump_compare(enum opcode op)
+{
+    switch (op) {
+    case OP_EQJZ:
+    case OP_EQIJZ:
+        return OP_EQ;
+    case OP_NEQJZ:
+    case OP_NEQIJZ:
+        return OP_NEQ;
+    case OP_LTJZ:
+    case OP_LTIJZ:
+        return OP_LT;
+    case OP_GTJZ:
+    case OP_GTIJZ:
+        return OP_GT;
+    case OP_LEJZ:
+    case OP_LEIJZ:
+        return OP_LE;
+    case OP_GEJZ:
+    case OP_GEIJZ:
+        return OP_GE;
+    default:
+        return OP_NOP;
+    }
+}
+
+// push imm on the data stack kept in the vm
+static void push_imm(struct asmbuf *b, data imm)
+{
+    mem(b, true, 0xff, 0, R12, OFF(dsp));
+    cell(b, OFF(dsp), OFF(ds));
+    if (fits32(imm)) {
+        mem(b, true, 0xc7, 0, RAX, 0);
+        emit32(b, imm);
+    } else {
+        movi(b, RCX, imm);
+        store(b, RAX, 0, RCX);
+    }
+}
+
+// pop the data stack kept in the vm into rdx and test it
+static void pop_test(struct asmbuf *b)
+{
+    cell(b, OFF(dsp), OFF(ds));
+    load(b, RDX, RAX, 0);
+    mem(b, true, 0xff, 1, R12, OFF(dsp));
+    rr(b, true, 0x85, RDX, RDX);
+}
+
+// the step of +loop, op_plusloop also reads its branch through the pc
+static void plusloop_step(struct forthvm *vm)
+{
+    data inc = vm_pop_ds(vm);
+    vm->rs[vm->rsp] += inc;
+}
+
+// JIT_CALLS mode, subroutine threading over the opfuncs of opcode.c
+static int translate_calls(struct jitctx *c, struct insn *in)
+{
+    struct asmbuf *b = &c->b;
+    data *target = insn_target(in);
+    enum opcode op = in->op;
+    switch (op) {
+    case OP_PUSH:
+        push_imm(b, in->arg[0]);
+        break;
+    case OP_ADDI:
+        push_imm(b, in->arg[0]);
+        ccall(c, op_add, 0);
+        break;
+    case OP_SHLI:
+    case OP_SHRI:
+        cell(b, OFF(dsp), OFF(ds));
+        shift(b, in, RAX);
+        break;
+    case OP_PICKI:
+        push_imm(b, in->arg[0]);
+        ccall(c, op_pick, 0);
+        break;
+    case OP_NEEDS:
+        load(b, RAX, R12, OFF(dsp));
+        needs(c, in->arg[0]);
+        break;
+    case OP_JMP:
+        add_fixup(c, jmp(b), *target);
+        break;
+    case OP_JZ:
+    case OP_JNZ:
+        pop_test(b);
+        add_fixup(c, jcc(b, op == OP_JZ ? CC_E : CC_NE), *target);
+        break;
+    case OP_DUPJZ:
+    case OP_DUPJNZ:
+        cell(b, OFF(dsp), OFF(ds));
+        mem(b, true, 0x83, 7, RAX, 0);
+        emit8(b, 0);
+        add_fixup(c, jcc(b, op == OP_DUPJZ ? CC_E : CC_NE), *target);
+        break;
+    case OP_EQJZ:
+    case OP_NEQJZ:
+    case OP_LTJZ:
+    case OP_GTJZ:
+    case OP_LEJZ:
+    case OP_GEJZ:
+    case OP_EQIJZ:
+    case OP_NEQIJZ:
+    case OP_LTIJZ:
+    case OP_GTIJZ:
+    case OP_LEIJZ:
+    case OP_GEIJZ:
+        if (get_opargs(op) == 2)
+            push_imm(b, in->arg[0]);
+        ccall(c, get_opfunc(jump_compare(op)), 0);
+        pop_test(b);
+        add_fixup(c, jcc(b, CC_E), *target);
+        break;
+    case OP_DO:
+        cell(b, OFF(rsp), OFF(rs));
+        load(b, RDX, RAX, 0);
+        mem(b, true, 0x3b, RDX, RAX, -8);
+        add_fixup(c, jcc(b, CC_GE), *target);
+        break;
+    case OP_LOOP:
+    case OP_PLUSLOOP:
+        if (op == OP_PLUSLOOP)
+            ccall(c, plusloop_step, 0);
+        cell(b, OFF(rsp), OFF(rs));
+        if (op == OP_LOOP)
+            mem(b, true, 0xff, 0, RAX, 0);
+        load(b, RDX, RAX, 0);
+        mem(b, true, 0x3b, RDX, RAX, -8);
+        add_fixup(c, jcc(b, CC_L), *target);
+        break;
+    case OP_EXIT:
+        ret(b);
+        break;
+    case OP_CALL:
+        call(c, in->arg[0], false);
+        break;
+    case OP_TAILCALL:
+        call(c, in->arg[0], true);
+        break;
+    case OP_NATIVE:
+        native(c, in->arg[0]);
+        break;
+    case OP_CFUNC:
+        ccall(c, (void *)in->arg[0], 0);
+        break;
+    case OP_JTAB:
+    case OP_BTAB:
+        cell(b, OFF(dsp), OFF(ds));
+        load(b, RAX, RAX, 0);
+        case_table(c, in);
+        break;
+    case OP_CASEJ:
+    case OP_NOP:
+        break;
+    case OP_EXECUTE:
+        execute(c);
+        break;
+    default:
+        // handlers read their operands through the pc
+        if (get_opargs(op) > 0)
+            return -1;
+        ccall(c, get_opfunc(op), 0);
+        break;
+    }
+    return 0;
+}
+
+bool jit_available(void) { return true; }
+
+int jit_compile(struct forthvm *vm, data entry)
+{
+    data start = vm->dict[entry];
+    data end = vm->codesz;
+    struct insnlist l;
+    insn_init(&l);
+    if (start < 0 || insn_decode(vm, &l, start, end) < 0) {
+        insn_free(&l);
+        return -1;
+    }
+    if (!insn_rs_balanced(&l) || (vm->jit == NULL && jit_init(vm) < 0)) {
+        insn_free(&l);
+        return -1;
+    }
+    struct jitctx c = {vm};
+    size_t *off = malloc(sizeof(size_t) * (l.size + 1));
+    addi(&c.b, RSP, -8);
+    int ok = 0;
+    for (int i = 0; i < l.size && ok == 0; i++) {
+        off[i] = c.b.len;
+        if (vm->jit->cached)
+            ok = translate(&c, &l.buf[i]);
+        else
+            ok = translate_calls(&c, &l.buf[i]);
+    }
+    off[l.size] = c.b.len;
+    ret(&c.b);
+    for (int i = 0; i < c.nfixups; i++)
+        patch(&c.b, c.fixups[i].pos, off[c.fixups[i].target]);
+    void *fn = ok == 0 ? arena_put(vm->jit, &c.b) : NULL;
+    free(c.b.p);
+    free(c.fixups);
+    free(off);
+    insn_free(&l);
+    if (fn == NULL)
+        return -1;
+    // the bytecode stays for inline_call
+    vm->dictcells[entry] = start;
+    vm_define(vm, entry, vm->codesz);
+    vm_emit_opcode(vm, OP_NATIVE);
+    vm_emit_data(vm, (data)fn);
+    vm_emit_opcode(vm, OP_EXIT);
+    vm_mark_label(vm);
+    return 0;
+}
+
+void jit_run(struct forthvm *vm, void *fn) { vm->jit->enter(vm, fn); }
+
+bool jit_fault(struct forthvm *vm, void *addr)
+{
+    struct jit *j = vm->jit;
+    if (j == NULL)
+        return false;
+    char *p = addr;
+    return p >= j->stack && p < j->stack + sysconf(_SC_PAGESIZE);
+}
+
+#else
+
+bool jit_available(void) { return false; }
+
+int jit_compile(struct forthvm *vm, data entry) { return -1; }
+
+void jit_run(struct forthvm *vm, void *fn) {}
+
+bool jit_fault(struct forthvm *vm, void *addr) { return false; }
+
+#endif
@@ -0,0 +1,37 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_JIT_H_
+#define REINFORTH_JIT_H_
+
+#include <stdbool.h>
+
+#include "types.h"
+
+struct forthvm;
+
+// false when this build cannot generate native code
+bool jit_available(void);
+// translate the definition of entry to native code and point the word at
+// it, returns -1 and leaves the word alone if it cannot be translated
+int jit_compile(struct forthvm *vm, data entry);
+// run the native code of a word, from OP_NATIVE
+void jit_run(struct forthvm *vm, void *fn);
+// whether addr is in the guard page of the stack native code runs on
+bool jit_fault(struct forthvm *vm, void *addr);
+
+#endif
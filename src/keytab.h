@@ -0,0 +1,187 @@
+// generated by scripts/genkeys.c from op_vec and syntax_name, do not edit
+
+#define KEY_MULT 0x5311c693u
+#define KEY_BITS 9
+
+static const struct keyword keywords[88] = {
+    {":", 1, KEY_SYNTAX, SYN_COLON},
+    {";", 1, KEY_SYNTAX, SYN_SEMI},
+    {"begin", 5, KEY_SYNTAX, SYN_BEGIN},
+    {"until", 5, KEY_SYNTAX, SYN_UNTIL},
+    {"if", 2, KEY_SYNTAX, SYN_IF},
+    {"else", 4, KEY_SYNTAX, SYN_ELSE},
+    {"then", 4, KEY_SYNTAX, SYN_THEN},
+    {"do", 2, KEY_SYNTAX, SYN_DO},
+    {"leave", 5, KEY_SYNTAX, SYN_LEAVE},
+    {"loop", 4, KEY_SYNTAX, SYN_LOOP},
+    {"+loop", 5, KEY_SYNTAX, SYN_PLUSLOOP},
+    {"again", 5, KEY_SYNTAX, SYN_AGAIN},
+    {"while", 5, KEY_SYNTAX, SYN_WHILE},
+    {"repeat", 6, KEY_SYNTAX, SYN_REPEAT},
+    {"noinline", 8, KEY_SYNTAX, SYN_NOINLINE},
+    {"case", 4, KEY_SYNTAX, SYN_CASE},
+    {"of", 2, KEY_SYNTAX, SYN_OF},
+    {"endof", 5, KEY_SYNTAX, SYN_ENDOF},
+    {"endcase", 7, KEY_SYNTAX, SYN_ENDCASE},
+    {"memoize", 7, KEY_SYNTAX, SYN_MEMOIZE},
+    {"dump", 4, KEY_OP, OP_DUMP},
+    {"rdump", 5, KEY_OP, OP_RDUMP},
+    {"depth", 5, KEY_OP, OP_DEPTH},
+    {"emit", 4, KEY_OP, OP_EMIT},
+    {"assert", 6, KEY_OP, OP_ASSERT},
+    {"rot", 3, KEY_OP, OP_ROT},
+    {"print", 5, KEY_OP, OP_PRINT},
+    {",", 1, KEY_OP, OP_COMMA},
+    {"here", 4, KEY_OP, OP_HERE},
+    {"cr", 2, KEY_OP, OP_CR},
+    {"+", 1, KEY_OP, OP_ADD},
+    {"-", 1, KEY_OP, OP_MINUS},
+    {"*", 1, KEY_OP, OP_MUL},
+    {"/", 1, KEY_OP, OP_DIV},
+    {"mod", 3, KEY_OP, OP_MOD},
+    {"/mod", 4, KEY_OP, OP_DIVMOD},
+    {"min", 3, KEY_OP, OP_MIN},
+    {"max", 3, KEY_OP, OP_MAX},
+    {"negate", 6, KEY_OP, OP_NEGATE},
+    {"=", 1, KEY_OP, OP_EQ},
+    {"<>", 2, KEY_OP, OP_NEQ},
+    {">", 1, KEY_OP, OP_GT},
+    {"<", 1, KEY_OP, OP_LT},
+    {">=", 2, KEY_OP, OP_GE},
+    {"<=", 2, KEY_OP, OP_LE},
+    {"and", 3, KEY_OP, OP_AND},
+    {"or", 2, KEY_OP, OP_OR},
+    {"not", 3, KEY_OP, OP_NOT},
+    {"bitand", 6, KEY_OP, OP_BITAND},
+    {"bitor", 5, KEY_OP, OP_BITOR},
+    {"invert", 6, KEY_OP, OP_INVERT},
+    {"xor", 3, KEY_OP, OP_XOR},
+    {"dup", 3, KEY_OP, OP_DUP},
+    {"over", 4, KEY_OP, OP_OVER},
+    {"swap", 4, KEY_OP, OP_SWAP},
+    {"drop", 4, KEY_OP, OP_DROP},
+    {".", 1, KEY_OP, OP_DOT},
+    {"create", 6, KEY_OP, OP_CREATE},
+    {"bye", 3, KEY_OP, OP_BYE},
+    {"exit", 4, KEY_OP, OP_EXIT},
+    {"cells", 5, KEY_OP, OP_CELLS},
+    {"chars", 5, KEY_OP, OP_CHARS},
+    {"allot", 5, KEY_OP, OP_ALLOT},
+    {"allocate", 8, KEY_OP, OP_ALLOCATE},
+    {"resize", 6, KEY_OP, OP_RESIZE},
+    {"free", 4, KEY_OP, OP_FREE},
+    {"!", 1, KEY_OP, OP_BANG},
+    {"@", 1, KEY_OP, OP_AT},
+    {"pick", 4, KEY_OP, OP_PICK},
+    {"rpick", 5, KEY_OP, OP_RPICK},
+    {"r>", 2, KEY_OP, OP_R2D},
+    {">r", 2, KEY_OP, OP_D2R},
+    {"r@", 2, KEY_OP, OP_RAT},
+    {"execute", 7, KEY_OP, OP_EXECUTE},
+    {"'", 1, KEY_OP, OP_QUOTE},
+    {"defer", 5, KEY_OP, OP_DEFER},
+    {"is", 2, KEY_OP, OP_IS},
+    {"unloop", 6, KEY_OP, OP_UNLOOP},
+    {"i", 1, KEY_OP, OP_I},
+    {"i'", 2, KEY_OP, OP_II},
+    {"j", 1, KEY_OP, OP_J},
+    {"heap-size", 9, KEY_OP, OP_HEAPSIZE},
+    {".fusions", 8, KEY_OP, OP_FUSIONS},
+    {".codesize", 9, KEY_OP, OP_CODESIZE},
+    {"stack-effect", 12, KEY_OP, OP_STACKEFFECT},
+    {".tiers", 6, KEY_OP, OP_TIERS},
+    {"relayout", 8, KEY_OP, OP_RELAYOUT},
+    {".memo", 5, KEY_OP, OP_MEMOS},
+};
+
+// one more than the index in keywords of the name in each slot
+static const uint16_t keyslot[1 << KEY_BITS] = {
+    [467] = 1,
+    [165] = 2,
+    [463] = 3,
+    [425] = 4,
+    [264] = 5,
+    [132] = 6,
+    [436] = 7,
+    [410] = 8,
+    [394] = 9,
+    [251] = 10,
+    [16] = 11,
+    [53] = 12,
+    [134] = 13,
+    [39] = 14,
+    [292] = 15,
+    [27] = 16,
+    [19] = 17,
+    [405] = 18,
+    [469] = 19,
+    [12] = 20,
+    [244] = 21,
+    [389] = 22,
+    [172] = 23,
+    [252] = 24,
+    [189] = 25,
+    [439] = 26,
+    [44] = 27,
+    [443] = 28,
+    [112] = 29,
+    [310] = 30,
+    [85] = 31,
+    [304] = 32,
+    [62] = 33,
+    [23] = 34,
+    [376] = 35,
+    [48] = 36,
+    [506] = 37,
+    [195] = 38,
+    [429] = 39,
+    [305] = 40,
+    [370] = 41,
+    [371] = 42,
+    [398] = 43,
+    [355] = 44,
+    [217] = 45,
+    [329] = 46,
+    [396] = 47,
+    [242] = 48,
+    [379] = 49,
+    [358] = 50,
+    [309] = 51,
+    [481] = 52,
+    [138] = 53,
+    [57] = 54,
+    [387] = 55,
+    [154] = 56,
+    [266] = 57,
+    [290] = 58,
+    [95] = 59,
+    [9] = 60,
+    [81] = 61,
+    [441] = 62,
+    [97] = 63,
+    [435] = 64,
+    [111] = 65,
+    [356] = 66,
+    [49] = 67,
+    [452] = 68,
+    [135] = 69,
+    [179] = 70,
+    [361] = 71,
+    [77] = 72,
+    [386] = 73,
+    [196] = 74,
+    [190] = 75,
+    [402] = 76,
+    [93] = 77,
+    [340] = 78,
+    [341] = 79,
+    [279] = 80,
+    [125] = 81,
+    [472] = 82,
+    [326] = 83,
+    [170] = 84,
+    [168] = 85,
+    [422] = 86,
+    [127] = 87,
+    [174] = 88,
+};
@@ -0,0 +1,41 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "keyword.h"
+
+#include <string.h>
+
+#include "crc32.h"
+#include "opcode.h"
+#include "syntax.h"
+
+// keywords[], keyslot[], KEY_MULT and KEY_BITS, made at build time by
+// scripts/genkeys.c from op_vec and syntax_name
+#include "keytab.h"
+
+uint32_t word_hash(const char *word, int len) { return crc32c(0, word, len); }
+
+const struct keyword *keyword_find(const char *word, int len, uint32_t h)
+{
+    int i = keyslot[(uint32_t)(h * KEY_MULT) >> (32 - KEY_BITS)];
+    if (i == 0)
+        return NULL;
+    const struct keyword *k = &keywords[i - 1];
+    if (k->len != len || memcmp(k->name, word, len) != 0)
+        return NULL;
+    return k;
+}
@@ -0,0 +1,42 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_KEYWORD_H_
+#define REINFORTH_KEYWORD_H_
+
+#include <stdint.h>
+
+enum keykind {
+    KEY_SYNTAX,
+    KEY_OP,
+};
+
+// a syntax word or a builtin, value is its enum syntax or enum opcode
+struct keyword {
+    const char *name;
+    int len;
+    enum keykind kind;
+    int value;
+};
+
+// hash of a word, shared by the keyword table and the word table
+uint32_t word_hash(const char *word, int len);
+// the keyword named by word with hash h, found in a single probe of a
+// perfect hash table, NULL for every other word
+const struct keyword *keyword_find(const char *word, int len, uint32_t h);
+
+#endif
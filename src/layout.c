@@ -0,0 +1,83 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "layout.h"
+
+#include <stdlib.h>
+
+#include "insn.h"
+#include "opcode.h"
+#include "tier.h"
+#include "vm.h"
+
+// Definitions are emitted in source order, between top level code,
+// variables and the stubs of C functions, so the words a program spends
+// its time in end up spread over the whole of code. The copies made here
+// keep them together. The old ones stay for the calls running in them
+// and the words inlined from them.
+struct hot {
+    data entry;
+    data hits;
+};
+
+static int by_hits(const void *a, const void *b)
+{
+    const struct hot *x = a, *y = b;
+    if (x->hits != y->hits)
+        return x->hits > y->hits ? -1 : 1;
+    return x->entry < y->entry ? -1 : 1;
+}
+
+// counted words with cells to move, native and compact code is called
+// through a stub and left where it is
+static bool movable(struct forthvm *vm, data entry)
+{
+    data start = vm->dict[entry];
+    if (vm->dicttier[entry] == TIER_NONE || vm->dicthits[entry] == 0 ||
+        start < 0 || vm->dictend[entry] <= start)
+        return false;
+    int op = vm_decode(vm, vm->code[start]);
+    return op >= 0 && op != OP_NATIVE && op != OP_COMPACT;
+}
+
+void relayout(struct forthvm *vm)
+{
+    struct hot *hs = malloc(sizeof(struct hot) * vm->dictsz);
+    data n = 0;
+    for (data i = 0; i < vm->dictsz; i++) {
+        if (movable(vm, i))
+            hs[n++] = (struct hot){i, vm->dicthits[i]};
+    }
+    qsort(hs, n, sizeof(struct hot), by_hits);
+    data over = vm_skip_begin(vm);
+    for (data k = 0; k < n; k++) {
+        data entry = hs[k].entry;
+        struct insnlist l;
+        insn_init(&l);
+        data from = vm->dict[entry];
+        if (insn_decode(vm, &l, from, vm->dictend[entry]) >= 0) {
+            vm_define(vm, entry, vm->codesz);
+            insn_encode(vm, &l);
+            vm_mark_label(vm);
+            vm->dictend[entry] = vm->codesz;
+            tier_forward(vm, from, vm->dict[entry]);
+        }
+        insn_free(&l);
+    }
+    vm_skip_end(vm, over);
+    free(hs);
+}
@@ -15,6 +15,11 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <getopt.h>
+#include <string.h>
+
+#include "compact.h"
+#include "jit.h"
 #include "vm.h"
 
 // begin extension demo
@@ -28,21 +33,176 @@ void myadd(struct forthvm *vm)
 void load_ext(struct forthvm *vm) { vm_regfunc(vm, "__myadd__", myadd); }
 // end extension demo
 
+static void usage(char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--engine=call|threaded|tos] [--data-stack=CELLS] "
+            "[--return-stack=CELLS] [--jit[=template|calls]] [--compact] "
+            "[--unroll-limit=CELLS] [--tier-threshold=N] [--memo-size=N] "
+            "[-O0|-O1] [-f[no-]OPT]... [file]\n"
+            "Optimizations: fuse peephole inline tail-call fold stack-effect "
+            "unroll case-table jit compact tier\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+static struct option long_options[] = {
+    {"engine", required_argument, NULL, 'e'},
+    {"data-stack", required_argument, NULL, 'D'},
+    {"return-stack", required_argument, NULL, 'R'},
+    {"jit", optional_argument, NULL, 'j'},
+    {"compact", no_argument, NULL, 'c'},
+    {"unroll-limit", required_argument, NULL, 'U'},
+    {"tier-threshold", required_argument, NULL, 'T'},
+    {"memo-size", required_argument, NULL, 'M'},
+    {NULL, 0, NULL, 0},
+};
+
+struct optname {
+    char *name;
+    int flag;
+};
+
+static struct optname optnames[] = {
+    {"fuse", OPT_FUSE},
+    {"peephole", OPT_PEEPHOLE},
+    {"inline", OPT_INLINE},
+    {"tail-call", OPT_TAILCALL},
+    {"jit", OPT_JIT},
+    {"fold", OPT_FOLD},
+    {"compact", OPT_COMPACT},
+    {"stack-effect", OPT_EFFECT},
+    {"unroll", OPT_UNROLL},
+    {"case-table", OPT_CASETAB},
+    {"tier", OPT_TIER},
+};
+
+// -fNAME enables an optimization, -fno-NAME disables it
+static bool parse_opt(char *arg, int *opts)
+{
+    bool on = true;
+    if (strncmp(arg, "no-", 3) == 0) {
+        on = false;
+        arg += 3;
+    }
+    for (int i = 0; i < sizeof(optnames) / sizeof(optnames[0]); i++) {
+        if (strcmp(arg, optnames[i].name) != 0)
+            continue;
+        if (on)
+            *opts |= optnames[i].flag;
+        else
+            *opts &= ~optnames[i].flag;
+        return true;
+    }
+    return false;
+}
+
 int main(int argc, char **argv)
 {
     struct forthvm vm;
     int ret;
     char *filename = "stdin";
     FILE *fin = stdin;
-    if (argc > 1) {
-        fin = fopen(argv[1], "r");
+    enum engine engine = DEFAULT_ENGINE;
+    int opts = OPT_DEFAULT;
+    enum jitmode jitmode = JIT_TEMPLATE;
+    data dssz = DEFAULT_STACKSZ;
+    data rssz = DEFAULT_STACKSZ;
+    data unrollmax = DEFAULT_UNROLL;
+    data tierhot = DEFAULT_TIERHOT;
+    data memosize = DEFAULT_MEMOSIZE;
+    int c;
+    while ((c = getopt_long(argc, argv, "e:f:O:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'e':
+            if (strcmp(optarg, "call") == 0) {
+                engine = ENGINE_CALL;
+            } else if (strcmp(optarg, "threaded") == 0) {
+                engine = ENGINE_THREADED;
+            } else if (strcmp(optarg, "tos") == 0) {
+                engine = ENGINE_TOS;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'D':
+            dssz = atol(optarg);
+            if (dssz <= 0)
+                usage(argv[0]);
+            break;
+        case 'R':
+            rssz = atol(optarg);
+            if (rssz <= 0)
+                usage(argv[0]);
+            break;
+        case 'j':
+            opts |= OPT_JIT;
+            if (optarg == NULL || strcmp(optarg, "template") == 0)
+                jitmode = JIT_TEMPLATE;
+            else if (strcmp(optarg, "calls") == 0)
+                jitmode = JIT_CALLS;
+            else
+                usage(argv[0]);
+            break;
+        case 'c':
+            opts |= OPT_COMPACT;
+            break;
+        case 'U':
+            unrollmax = atol(optarg);
+            if (unrollmax < 0)
+                usage(argv[0]);
+            break;
+        case 'T':
+            tierhot = atol(optarg);
+            if (tierhot <= 0)
+                usage(argv[0]);
+            break;
+        case 'M':
+            memosize = atol(optarg);
+            if (memosize <= 0)
+                usage(argv[0]);
+            break;
+        case 'O':
+            opts = atoi(optarg) > 0 ? OPT_DEFAULT : 0;
+            break;
+        case 'f':
+            if (!parse_opt(optarg, &opts))
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        fin = fopen(argv[optind], "r");
         if (fin == NULL) {
-            fprintf(stderr, "Failed to open file: %s\n", argv[1]);
+            fprintf(stderr, "Failed to open file: %s\n", argv[optind]);
             exit(EXIT_FAILURE);
         }
-        filename = argv[1];
+        filename = argv[optind];
     }
     vm_init(&vm, fin, stdout);
+    if (vm_set_engine(&vm, engine) < 0) {
+        fprintf(stderr, "Engine not available in this build\n");
+        exit(EXIT_FAILURE);
+    }
+    if (vm_stacksz(&vm, dssz, rssz) < 0) {
+        fprintf(stderr, "Failed to map stacks\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((opts & OPT_JIT) && !jit_available()) {
+        fprintf(stderr, "No jit in this build, interpreting\n");
+        opts &= ~OPT_JIT;
+    }
+    if ((opts & OPT_COMPACT) && !compact_available()) {
+        fprintf(stderr, "No compact format in this build, using cells\n");
+        opts &= ~OPT_COMPACT;
+    }
+    vm.opts = opts;
+    vm.jitmode = jitmode;
+    vm.unrollmax = unrollmax;
+    vm.tierhot = tierhot;
+    vm.memosize = memosize;
     // extensions must be loaded after initialization
     load_ext(&vm);
     vm_run(&vm);
@@ -0,0 +1,141 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "memo.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "tier.h"
+#include "vm.h"
+
+// A memoized word is called through
+//
+//     memo k  call body  memosave k  exit
+//
+// where memo returns at once on a hit. The call is not linked to the word
+// like other calls, so it stays on the body while the rest, recursive
+// calls included, go to the cache.
+
+static uint32_t memo_hash(void *p)
+{
+    struct memo_entry *e = p;
+    return crc32(0, e->key, sizeof(e->key));
+}
+
+static bool memo_eq(void *a, void *b)
+{
+    struct memo_entry *x = a, *y = b;
+    return memcmp(x->key, y->key, sizeof(x->key)) == 0;
+}
+
+void memo_declare(struct forthvm *vm, data entry)
+{
+    if (entry < 0 || vm->dicttier[entry] == TIER_NONE)
+        vm_error(vm, "only colon definitions can be memoized");
+    if (vm->dictflags[entry] & WORD_MEMO)
+        vm_error(vm, "word already memoized");
+    // the effect of a first tier word is not known yet
+    if (vm->dicttier[entry] == TIER_BASE)
+        tier_promote(vm, entry);
+    data in = vm->dictin[entry], out = vm->dictout[entry];
+    if (in < 0 || in > MEMO_CELLS || out > MEMO_CELLS)
+        vm_error(vm, "memoize needs a stack effect of at most 4 cells");
+    if (vm->nmemos >= vm->memocap) {
+        vm->memocap = vm->memocap < 4 ? 4 : vm->memocap * 2;
+        vm->memos = realloc(vm->memos, sizeof(struct memo) * vm->memocap);
+    }
+    data k = vm->nmemos++;
+    struct memo *m = &vm->memos[k];
+    *m = (struct memo){entry, in, out};
+    m->cap = vm->memosize;
+    m->ring = malloc(sizeof(struct memo_entry) * m->cap);
+    htable_init(&m->table, sizeof(struct memo_entry), -1, memo_hash, memo_eq);
+
+    data body = vm->dict[entry];
+    data over = vm_skip_begin(vm);
+    data stub = vm->codesz;
+    vm_emit_opcode(vm, OP_MEMO);
+    vm_emit_data(vm, k);
+    vm_emit_opcode(vm, OP_CALL);
+    vm_emit_data(vm, entry);
+    vm_emit_data(vm, body);
+    vm_emit_opcode(vm, OP_MEMOSAVE);
+    vm_emit_data(vm, k);
+    vm_emit_opcode(vm, OP_EXIT);
+    vm_skip_end(vm, over);
+    vm_define(vm, entry, stub);
+    vm->dictflags[entry] |= WORD_MEMO;
+}
+
+bool memo_find(struct forthvm *vm, data k)
+{
+    struct memo *m = &vm->memos[k];
+    struct memo_entry key = {0};
+    data *args = &vm->ds[vm->dsp - m->in + 1];
+    memcpy(key.key, args, sizeof(data) * m->in);
+    struct memo_entry *e = htable_find(&m->table, &key);
+    if (e == NULL) {
+        m->misses++;
+        for (int i = 0; i < m->in; i++)
+            vm_push_rs(vm, args[i]);
+        return false;
+    }
+    m->hits++;
+    vm->dsp -= m->in;
+    for (int i = 0; i < m->out; i++)
+        vm_push_ds(vm, e->val[i]);
+    return true;
+}
+
+void memo_save(struct forthvm *vm, data k)
+{
+    struct memo *m = &vm->memos[k];
+    struct memo_entry e = {0};
+    for (int i = m->in - 1; i >= 0; i--)
+        e.key[i] = vm_pop_rs(vm);
+    memcpy(e.val, &vm->ds[vm->dsp - m->out + 1], sizeof(data) * m->out);
+    // stored meanwhile by a call made from the body
+    struct memo_entry *old = htable_find(&m->table, &e);
+    if (old != NULL) {
+        *old = e;
+        return;
+    }
+    if (m->table.size >= m->cap) {
+        old = htable_find(&m->table, &m->ring[m->next]);
+        if (old != NULL)
+            htable_del(&m->table, old);
+        m->evictions++;
+    }
+    htable_insert(&m->table, &e);
+    m->ring[m->next] = e;
+    m->next = (m->next + 1) % m->cap;
+}
+
+void memo_report(struct forthvm *vm)
+{
+    char **names = vm_word_names(vm);
+    for (data k = 0; k < vm->nmemos; k++) {
+        struct memo *m = &vm->memos[k];
+        fprintf(vm->out,
+                "%-12s %d entries, %ld hits, %ld misses, %ld evictions\n",
+                names[m->entry], m->table.size, (long)m->hits,
+                (long)m->misses, (long)m->evictions);
+    }
+    free(names);
+}
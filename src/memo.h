@@ -0,0 +1,60 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_MEMO_H_
+#define REINFORTH_MEMO_H_
+
+#include <stdbool.h>
+
+#include "htable.h"
+#include "types.h"
+
+// most cells a memoized word may take or leave
+#define MEMO_CELLS 4
+
+struct forthvm;
+
+struct memo_entry {
+    data key[MEMO_CELLS];
+    data val[MEMO_CELLS];
+};
+
+// the results of a word by its arguments, at most cap of them, the oldest
+// evicted first
+struct memo {
+    data entry;
+    int in;
+    int out;
+    HTable table;
+    // keys in the order they were stored, next is the oldest once full
+    struct memo_entry *ring;
+    data cap;
+    data next;
+    data hits;
+    data misses;
+    data evictions;
+};
+
+// route calls to the last word through a cache of its results
+void memo_declare(struct forthvm *vm, data entry);
+// true with the results in place of the arguments if they are cached,
+// else the arguments are copied to the return stack for memo_save
+bool memo_find(struct forthvm *vm, data k);
+void memo_save(struct forthvm *vm, data k);
+void memo_report(struct forthvm *vm);
+
+#endif
@@ -20,27 +20,26 @@
 #include <assert.h>
 #include <string.h>
 
+#include "compact.h"
+#include "effect.h"
+#include "fuse.h"
+#include "inline.h"
+#include "jit.h"
+#include "layout.h"
+#include "memo.h"
+#include "tier.h"
 #include "vm.h"
 
-#define CHECKERR                                                               \
-    if (vm->finished)                                                          \
-        return;
+// errors unwind to vm_run from vm_error, nothing checks for them after a
+// call returns
 
 #define CHECKDS(len)                                                           \
-    if (vm->dsp < len) {                                                       \
-        vm->ret = -1;                                                          \
-        vm->finished = true;                                                   \
-        vm->errmsg = "no enough element on data stack";                        \
-        return;                                                                \
-    }
+    if (vm->dsp < len)                                                         \
+    vm_error(vm, "no enough element on data stack")
 
 #define CHECKRS(len)                                                           \
-    if (vm->rsp < len) {                                                       \
-        vm->ret = -1;                                                          \
-        vm->finished = true;                                                   \
-        vm->errmsg = "no enough element on return stack";                      \
-        return;                                                                \
-    }
+    if (vm->rsp < len)                                                         \
+    vm_error(vm, "no enough element on return stack")
 
 char *op_vec[OP_NOP + 1] = {
     [OP_DUMP] = "dump",
@@ -104,15 +103,54 @@ char *op_vec[OP_NOP + 1] = {
     [OP_RAT] = "r@",
     [OP_EXECUTE] = "execute",
     [OP_QUOTE] = "'",
+    [OP_DEFER] = "defer",
+    [OP_IS] = "is",
     [OP_CFUNC] = "cfunc\t",
     [OP_DO] = "do\t",
     [OP_LOOP] = "loop\t",
     [OP_PLUSLOOP] = "+loop\t",
+    [OP_UNLOOP] = "unloop",
     [OP_CFUNC] = "cfunc\t",
     [OP_I] = "i",
     [OP_II] = "i'",
     [OP_J] = "j",
     [OP_HEAPSIZE] = "heap-size",
+    [OP_FUSIONS] = ".fusions",
+    [OP_CODESIZE] = ".codesize",
+    [OP_STACKEFFECT] = "stack-effect",
+    [OP_TIERS] = ".tiers",
+    [OP_RELAYOUT] = "relayout",
+    [OP_MEMOS] = ".memo",
+    [OP_ADDI] = "addi\t",
+    [OP_2DUP] = "2dup\t",
+    [OP_JNZ] = "jnz\t",
+    [OP_DUPJZ] = "dupjz\t",
+    [OP_DUPJNZ] = "dupjnz\t",
+    [OP_EQJZ] = "eqjz\t",
+    [OP_NEQJZ] = "neqjz\t",
+    [OP_LTJZ] = "ltjz\t",
+    [OP_GTJZ] = "gtjz\t",
+    [OP_LEJZ] = "lejz\t",
+    [OP_GEJZ] = "gejz\t",
+    [OP_EQIJZ] = "eqijz\t",
+    [OP_NEQIJZ] = "neqijz\t",
+    [OP_LTIJZ] = "ltijz\t",
+    [OP_GTIJZ] = "gtijz\t",
+    [OP_LEIJZ] = "leijz\t",
+    [OP_GEIJZ] = "geijz\t",
+    [OP_SHLI] = "shli\t",
+    [OP_SHRI] = "shri\t",
+    [OP_PICKI] = "picki\t",
+    [OP_NEEDS] = "needs\t",
+    [OP_JTAB] = "jtab\t",
+    [OP_BTAB] = "btab\t",
+    [OP_CASEJ] = "casej\t",
+    [OP_TICK] = "tick\t",
+    [OP_MEMO] = "memo\t",
+    [OP_MEMOSAVE] = "memosave\t",
+    [OP_TAILCALL] = "tailcall\t",
+    [OP_NATIVE] = "native\t",
+    [OP_COMPACT] = "compact\t",
 };
 
 opfunc op_funcvec[OP_NOP + 1] = {
@@ -122,8 +160,11 @@ opfunc op_funcvec[OP_NOP + 1] = {
     [OP_DO] = op_do,
     [OP_LOOP] = op_loop,
     [OP_PLUSLOOP] = op_plusloop,
+    [OP_UNLOOP] = op_unloop,
     [OP_EXECUTE] = op_execute,
     [OP_QUOTE] = op_quote,
+    [OP_DEFER] = op_defer,
+    [OP_IS] = op_is,
     [OP_CFUNC] = op_cfunc,
     [OP_PICK] = op_pick,
     [OP_RPICK] = op_rpick,
@@ -184,10 +225,118 @@ opfunc op_funcvec[OP_NOP + 1] = {
     [OP_AT] = op_at,
     [OP_NOP] = op_nop,
     [OP_HEAPSIZE] = op_heapsize,
+    [OP_FUSIONS] = op_fusions,
+    [OP_CODESIZE] = op_codesize,
+    [OP_STACKEFFECT] = op_stackeffect,
+    [OP_TIERS] = op_tiers,
+    [OP_RELAYOUT] = op_relayout,
+    [OP_MEMOS] = op_memos,
+    [OP_ADDI] = op_addi,
+    [OP_2DUP] = op_2dup,
+    [OP_JNZ] = op_jnz,
+    [OP_DUPJZ] = op_dupjz,
+    [OP_DUPJNZ] = op_dupjnz,
+    [OP_EQJZ] = op_eqjz,
+    [OP_NEQJZ] = op_neqjz,
+    [OP_LTJZ] = op_ltjz,
+    [OP_GTJZ] = op_gtjz,
+    [OP_LEJZ] = op_lejz,
+    [OP_GEJZ] = op_gejz,
+    [OP_EQIJZ] = op_eqijz,
+    [OP_NEQIJZ] = op_neqijz,
+    [OP_LTIJZ] = op_ltijz,
+    [OP_GTIJZ] = op_gtijz,
+    [OP_LEIJZ] = op_leijz,
+    [OP_GEIJZ] = op_geijz,
+    [OP_SHLI] = op_shli,
+    [OP_SHRI] = op_shri,
+    [OP_PICKI] = op_picki,
+    [OP_NEEDS] = op_needs,
+    [OP_JTAB] = op_jtab,
+    [OP_BTAB] = op_btab,
+    [OP_CASEJ] = op_casej,
+    [OP_TICK] = op_tick,
+    [OP_MEMO] = op_memo,
+    [OP_MEMOSAVE] = op_memosave,
+    [OP_TAILCALL] = op_tailcall,
+    [OP_NATIVE] = op_native,
+    [OP_COMPACT] = op_compact,
+};
+
+// number of operand cells following the opcode cell
+int op_argvec[OP_NOP + 1] = {
+    [OP_CALL] = 2,   [OP_PUSH] = 1,   [OP_JMP] = 1,    [OP_JZ] = 1,
+    [OP_CFUNC] = 1,  [OP_DO] = 1,     [OP_ADDI] = 1,   [OP_JNZ] = 1,
+    [OP_DUPJZ] = 1,  [OP_DUPJNZ] = 1, [OP_EQJZ] = 1,   [OP_NEQJZ] = 1,
+    [OP_LTJZ] = 1,   [OP_GTJZ] = 1,   [OP_LEJZ] = 1,   [OP_GEJZ] = 1,
+    [OP_EQIJZ] = 2,  [OP_NEQIJZ] = 2, [OP_LTIJZ] = 2,  [OP_GTIJZ] = 2,
+    [OP_LEIJZ] = 2,  [OP_GEIJZ] = 2,  [OP_TAILCALL] = 2,
+    [OP_NATIVE] = 1, [OP_SHLI] = 1,   [OP_SHRI] = 1,   [OP_COMPACT] = 1,
+    [OP_PICKI] = 1,  [OP_NEEDS] = 1,  [OP_LOOP] = 1,   [OP_PLUSLOOP] = 1,
+    [OP_JTAB] = 1,   [OP_BTAB] = 1,   [OP_CASEJ] = 2,  [OP_TICK] = 1,
+    [OP_MEMO] = 1,   [OP_MEMOSAVE] = 1,
+};
+
+// opcodes whose last operand is an address in code to jump to
+bool op_jumpvec[OP_NOP + 1] = {
+    [OP_JMP] = true,    [OP_JZ] = true,    [OP_DO] = true,
+    [OP_JNZ] = true,    [OP_DUPJZ] = true, [OP_DUPJNZ] = true,
+    [OP_EQJZ] = true,   [OP_NEQJZ] = true, [OP_LTJZ] = true,
+    [OP_GTJZ] = true,   [OP_LEJZ] = true,  [OP_GEJZ] = true,
+    [OP_EQIJZ] = true,  [OP_NEQIJZ] = true, [OP_LTIJZ] = true,
+    [OP_GTIJZ] = true,  [OP_LEIJZ] = true, [OP_GEIJZ] = true,
+    [OP_LOOP] = true,   [OP_PLUSLOOP] = true, [OP_CASEJ] = true,
+};
+
+// data stack cells each opcode reads and leaves, as in ( in -- out ). The
+// ones left out touch no cell, -1 is for those depending on more than the
+// opcode: calls, pick, execute and code outside the bytecode.
+signed char op_effectvec[OP_NOP + 1][2] = {
+    [OP_ADD] = {2, 1},         [OP_MINUS] = {2, 1},     [OP_MUL] = {2, 1},
+    [OP_DIV] = {2, 1},         [OP_MOD] = {2, 1},       [OP_DIVMOD] = {2, 2},
+    [OP_MIN] = {2, 1},         [OP_MAX] = {2, 1},       [OP_NEGATE] = {1, 1},
+    [OP_EQ] = {2, 1},          [OP_NEQ] = {2, 1},       [OP_GT] = {2, 1},
+    [OP_LT] = {2, 1},          [OP_GE] = {2, 1},        [OP_LE] = {2, 1},
+    [OP_AND] = {2, 1},         [OP_OR] = {2, 1},        [OP_NOT] = {1, 1},
+    [OP_BITAND] = {2, 1},      [OP_BITOR] = {2, 1},     [OP_INVERT] = {1, 1},
+    [OP_XOR] = {2, 1},         [OP_DUP] = {1, 2},       [OP_OVER] = {2, 3},
+    [OP_SWAP] = {2, 2},        [OP_DROP] = {1, 0},      [OP_DOT] = {1, 0},
+    [OP_CALL] = {-1, -1},      [OP_PUSH] = {0, 1},      [OP_JZ] = {1, 0},
+    [OP_CELLS] = {1, 1},       [OP_CHARS] = {1, 1},     [OP_ALLOT] = {1, 0},
+    [OP_ALLOCATE] = {1, 1},    [OP_RESIZE] = {2, 1},    [OP_FREE] = {1, 0},
+    [OP_BANG] = {2, 0},        [OP_AT] = {1, 1},        [OP_COMMA] = {1, 0},
+    [OP_HERE] = {0, 1},        [OP_PRINT] = {1, 0},     [OP_EMIT] = {1, 0},
+    [OP_ASSERT] = {1, 0},      [OP_ROT] = {3, 3},       [OP_DEPTH] = {0, 1},
+    [OP_PICK] = {-1, -1},      [OP_RPICK] = {1, 1},     [OP_D2R] = {1, 0},
+    [OP_R2D] = {0, 1},         [OP_RAT] = {0, 1},       [OP_EXECUTE] = {-1, -1},
+    [OP_QUOTE] = {0, 1},       [OP_CFUNC] = {-1, -1},   [OP_PLUSLOOP] = {1, 0},
+    [OP_IS] = {1, 0},
+    [OP_I] = {0, 1},           [OP_II] = {0, 1},        [OP_J] = {0, 1},
+    [OP_HEAPSIZE] = {1, 0},    [OP_ADDI] = {1, 1},      [OP_2DUP] = {2, 4},
+    [OP_JNZ] = {1, 0},         [OP_DUPJZ] = {1, 1},     [OP_DUPJNZ] = {1, 1},
+    [OP_EQJZ] = {2, 0},        [OP_NEQJZ] = {2, 0},     [OP_LTJZ] = {2, 0},
+    [OP_GTJZ] = {2, 0},        [OP_LEJZ] = {2, 0},      [OP_GEJZ] = {2, 0},
+    [OP_EQIJZ] = {1, 0},       [OP_NEQIJZ] = {1, 0},    [OP_LTIJZ] = {1, 0},
+    [OP_GTIJZ] = {1, 0},       [OP_LEIJZ] = {1, 0},     [OP_GEIJZ] = {1, 0},
+    [OP_SHLI] = {1, 1},        [OP_SHRI] = {1, 1},      [OP_PICKI] = {-1, -1},
+    [OP_NEEDS] = {-1, -1},     [OP_TAILCALL] = {-1, -1},  [OP_MEMO] = {-1, -1},
+    [OP_JTAB] = {1, 1},        [OP_BTAB] = {1, 1},
+    [OP_NATIVE] = {-1, -1},    [OP_COMPACT] = {-1, -1},
 };
 
 char *get_opname(enum opcode op) { return op_vec[(int)op]; }
 
+int get_opargs(enum opcode op) { return op_argvec[(int)op]; }
+
+bool is_jump(enum opcode op) { return op_jumpvec[(int)op]; }
+
+bool get_opeffect(enum opcode op, int *in, int *out)
+{
+    *in = op_effectvec[(int)op][0];
+    *out = op_effectvec[(int)op][1];
+    return *in >= 0;
+}
+
 opfunc get_opfunc(enum opcode op) { return op_funcvec[(int)op]; }
 
 data get_opaddr(enum opcode op)
@@ -199,31 +348,26 @@ data get_opaddr(enum opcode op)
 void op_heapsize(struct forthvm *vm)
 {
     data sz = vm_pop_ds(vm);
-    CHECKERR;
     vm_heapsz(vm, sz);
 }
 
 void op_i(struct forthvm *vm)
 {
-    CHECKRS(1);
     vm_push_ds(vm, vm->rs[vm->rsp]);
 }
 
 void op_ii(struct forthvm *vm)
 {
-    CHECKRS(2);
     vm_push_ds(vm, vm->rs[vm->rsp - 1]);
 }
 
 void op_j(struct forthvm *vm)
 {
-    CHECKRS(3);
     vm_push_ds(vm, vm->rs[vm->rsp - 2]);
 }
 
 void op_do(struct forthvm *vm)
 {
-    CHECKRS(2);
     data i = vm->rs[vm->rsp];
     data limit = vm->rs[vm->rsp - 1];
     vm->pc++;
@@ -234,20 +378,30 @@ void op_do(struct forthvm *vm)
     vm->pc = end - 1;
 }
 
-void op_loop(struct forthvm *vm) { vm->rs[vm->rsp]++; }
+// back to the start of the body while the index is below the limit
+void op_loop(struct forthvm *vm)
+{
+    vm->pc++;
+    data body = vm->code[vm->pc];
+    if (++vm->rs[vm->rsp] < vm->rs[vm->rsp - 1])
+        vm->pc = body - 1;
+}
 
 void op_plusloop(struct forthvm *vm)
 {
     data inc = vm_pop_ds(vm);
-    CHECKERR;
-    CHECKRS(1);
+    vm->pc++;
+    data body = vm->code[vm->pc];
     vm->rs[vm->rsp] += inc;
+    if (vm->rs[vm->rsp] < vm->rs[vm->rsp - 1])
+        vm->pc = body - 1;
 }
 
+void op_unloop(struct forthvm *vm) { vm->rsp -= 2; }
+
 void op_pick(struct forthvm *vm)
 {
     data a = vm_pop_ds(vm);
-    CHECKERR;
     CHECKDS(a);
     vm_push_ds(vm, vm->ds[vm->dsp - a]);
 }
@@ -255,7 +409,6 @@ void op_pick(struct forthvm *vm)
 void op_rpick(struct forthvm *vm)
 {
     data a = vm_pop_ds(vm);
-    CHECKERR;
     CHECKRS(a);
     vm_push_ds(vm, vm->rs[vm->rsp - a]);
 }
@@ -263,29 +416,26 @@ void op_rpick(struct forthvm *vm)
 void op_d2r(struct forthvm *vm)
 {
     data a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_rs(vm, a);
 }
 
 void op_r2d(struct forthvm *vm)
 {
     data a = vm_pop_rs(vm);
-    CHECKERR;
     vm_push_ds(vm, a);
 }
 
 void op_rat(struct forthvm *vm)
 {
-    CHECKRS(1);
     vm_push_ds(vm, vm->rs[vm->rsp]);
 }
 
 void op_dump(struct forthvm *vm)
 {
     data depth = vm->dsp;
-    fprintf(vm->out, "<%lld> ", depth);
+    fprintf(vm->out, "<%ld> ", (long)depth);
     for (int i = 1; i <= depth; i++) {
-        fprintf(vm->out, "%ld ", vm->ds[i]);
+        fprintf(vm->out, "%ld ", (long)vm->ds[i]);
     }
     fprintf(vm->out, "<top>");
 }
@@ -293,9 +443,9 @@ void op_dump(struct forthvm *vm)
 void op_rdump(struct forthvm *vm)
 {
     data depth = vm->rsp;
-    fprintf(vm->out, "[%lld] ", depth);
+    fprintf(vm->out, "[%ld] ", (long)depth);
     for (int i = 1; i <= depth; i++) {
-        fprintf(vm->out, "%ld ", vm->rs[i]);
+        fprintf(vm->out, "%ld ", (long)vm->rs[i]);
     }
     fprintf(vm->out, "[top]");
 }
@@ -309,23 +459,18 @@ void op_depth(struct forthvm *vm)
 void op_emit(struct forthvm *vm)
 {
     char c = vm_pop_ds(vm);
-    CHECKERR;
     fprintf(vm->out, "%c", c);
 }
 
 void op_assert(struct forthvm *vm)
 {
     data a = vm_pop_ds(vm);
-    CHECKERR;
-    if (!a) {
-        vm->finished = true;
-        vm->ret = -2;
-    }
+    if (!a)
+        vm_halt(vm, -2);
 }
 
 void op_rot(struct forthvm *vm)
 {
-    CHECKDS(3);
     data t = vm->ds[vm->dsp - 2];
     vm->ds[vm->dsp - 2] = vm->ds[vm->dsp - 1];
     vm->ds[vm->dsp - 1] = vm->ds[vm->dsp];
@@ -335,23 +480,20 @@ void op_rot(struct forthvm *vm)
 void op_comma(struct forthvm *vm)
 {
     vm_heap_grow(vm, sizeof(data));
-    CHECKERR;
     data *p = vm->heaptop - sizeof(data);
     data a = vm_pop_ds(vm);
-    CHECKERR;
     *p = a;
 }
 
 void op_print(struct forthvm *vm)
 {
-    char *s = (char *)vm_pop_ds(vm);
-    CHECKERR;
+    char *s = VM_PTR(vm, vm_pop_ds(vm));
     fprintf(vm->out, "%s", s);
 }
 
 void op_here(struct forthvm *vm)
 {
-    data a = (data)vm->heaptop;
+    data a = VM_ADDR(vm, vm->heaptop);
     vm_push_ds(vm, a);
 }
 
@@ -361,9 +503,7 @@ void op_add(struct forthvm *vm)
 {
     data a, b;
     a = vm_pop_ds(vm);
-    CHECKERR;
     b = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a + b);
 }
 
@@ -371,9 +511,7 @@ void op_minus(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a - b);
 }
 
@@ -381,9 +519,7 @@ void op_mul(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a * b);
 }
 
@@ -391,9 +527,7 @@ void op_div(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a / b);
 }
 
@@ -401,9 +535,7 @@ void op_mod(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a % b);
 }
 
@@ -411,9 +543,7 @@ void op_divmod(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a % b);
     vm_push_ds(vm, a / b);
 }
@@ -422,9 +552,7 @@ void op_min(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a < b ? a : b);
 }
 
@@ -432,9 +560,7 @@ void op_max(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a > b ? a : b);
 }
 
@@ -442,7 +568,6 @@ void op_negate(struct forthvm *vm)
 {
     data a;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, -a);
 }
 
@@ -450,9 +575,7 @@ void op_eq(struct forthvm *vm)
 {
     data a, b;
     a = vm_pop_ds(vm);
-    CHECKERR;
     b = vm_pop_ds(vm);
-    CHECKERR;
     if (a == b)
         vm_push_ds(vm, -1);
     else
@@ -463,9 +586,7 @@ void op_neq(struct forthvm *vm)
 {
     data a, b;
     a = vm_pop_ds(vm);
-    CHECKERR;
     b = vm_pop_ds(vm);
-    CHECKERR;
     if (a == b)
         vm_push_ds(vm, 0);
     else
@@ -476,9 +597,7 @@ void op_gt(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     data r;
     if (a > b) {
         r = -1;
@@ -492,9 +611,7 @@ void op_lt(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     data r;
     if (a < b) {
         r = -1;
@@ -508,9 +625,7 @@ void op_ge(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     data r;
     if (a >= b) {
         r = -1;
@@ -524,9 +639,7 @@ void op_le(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     data r;
     if (a <= b) {
         r = -1;
@@ -540,9 +653,7 @@ void op_and(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a && b ? -1 : 0);
 }
 
@@ -550,9 +661,7 @@ void op_or(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a || b ? -1 : 0);
 }
 
@@ -560,7 +669,6 @@ void op_not(struct forthvm *vm)
 {
     data a;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a ? 0 : -1);
 }
 
@@ -568,9 +676,7 @@ void op_bitand(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a & b);
 }
 
@@ -578,9 +684,7 @@ void op_bitor(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a | b);
 }
 
@@ -588,7 +692,6 @@ void op_invert(struct forthvm *vm)
 {
     data a;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, ~a);
 }
 
@@ -596,15 +699,12 @@ void op_xor(struct forthvm *vm)
 {
     data a, b;
     b = vm_pop_ds(vm);
-    CHECKERR;
     a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a ^ b);
 }
 
 void op_dup(struct forthvm *vm)
 {
-    CHECKDS(1);
     data a;
     a = vm->ds[vm->dsp];
     vm_push_ds(vm, a);
@@ -612,31 +712,24 @@ void op_dup(struct forthvm *vm)
 
 void op_over(struct forthvm *vm)
 {
-    CHECKDS(2);
     data a = vm->ds[vm->dsp - 1];
     vm_push_ds(vm, a);
 }
 
 void op_swap(struct forthvm *vm)
 {
-    CHECKDS(2);
     data t;
     t = vm->ds[vm->dsp];
     vm->ds[vm->dsp] = vm->ds[vm->dsp - 1];
     vm->ds[vm->dsp - 1] = t;
 }
 
-void op_drop(struct forthvm *vm)
-{
-    CHECKDS(1);
-    vm->dsp--;
-}
+void op_drop(struct forthvm *vm) { vm_pop_ds(vm); }
 
 void op_dot(struct forthvm *vm)
 {
     data a = vm_pop_ds(vm);
-    CHECKERR;
-    fprintf(vm->out, "%ld ", a);
+    fprintf(vm->out, "%ld ", (long)a);
 }
 
 void op_push(struct forthvm *vm)
@@ -646,16 +739,55 @@ void op_push(struct forthvm *vm)
     vm_push_ds(vm, a);
 }
 
-void op_bye(struct forthvm *vm)
+void op_bye(struct forthvm *vm) { vm_halt(vm, 0); }
+
+// An execution token is the address of the code of a word, so execute
+// jumps to it without a lookup. Builtins get a body of their own the first
+// time they are quoted.
+void op_quote(struct forthvm *vm)
+{
+    data a = vm_read_word(vm);
+    if (a <= OP_NOP && vm->dict[a] < 0) {
+        data over = vm_skip_begin(vm);
+        vm_define(vm, a, vm->codesz);
+        vm_emit_opcode(vm, a);
+        vm_emit_opcode(vm, OP_EXIT);
+        vm_skip_end(vm, over);
+    }
+    if (vm->dict[a] < 0)
+        vm_error(vm, "undefined word");
+    vm_push_ds(vm, vm->dict[a]);
+}
+
+static void defer_unset(struct forthvm *vm)
 {
-    vm->finished = true;
-    vm->ret = 0;
+    vm_error(vm, "deferred word not set");
 }
 
-void op_quote(struct forthvm *vm)
+// a deferred word is a jump, is patches its target
+void op_defer(struct forthvm *vm)
 {
+    data over = vm_skip_begin(vm);
     data a = vm_read_word(vm);
-    vm_push_ds(vm, a);
+    vm_define(vm, a, vm->codesz);
+    vm->dictin[a] = -1;
+    vm->dictout[a] = -1;
+    vm->dictflags[a] |= WORD_NOINLINE | WORD_DEFER;
+    vm_emit_opcode(vm, OP_JMP);
+    vm_emit_data(vm, vm->codesz + 1);
+    vm_emit_opcode(vm, OP_CFUNC);
+    vm_emit_data(vm, vm_cfunc_cell(vm, defer_unset));
+    inline_redefine(vm, a);
+    vm_skip_end(vm, over);
+}
+
+void op_is(struct forthvm *vm)
+{
+    data a = vm_read_word(vm);
+    data xt = vm_pop_ds(vm);
+    if (!(vm->dictflags[a] & WORD_DEFER))
+        vm_error(vm, "not a deferred word");
+    vm->code[vm->dict[a] + 1] = xt;
 }
 
 void op_create(struct forthvm *vm)
@@ -665,10 +797,15 @@ void op_create(struct forthvm *vm)
     data addr_ptr = vm->codesz - 1;
     data a = vm_read_word(vm);
     data b = vm->codesz;
-    vm->dict[a] = b;
+    vm_define(vm, a, b);
+    vm->dictin[a] = 0;
+    vm->dictout[a] = 1;
+    vm->lastword = a;
     vm_emit_opcode(vm, OP_PUSH);
-    vm_emit_data(vm, (data)vm->heaptop);
+    vm_emit_data(vm, VM_ADDR(vm, vm->heaptop));
     vm_emit_opcode(vm, OP_EXIT);
+    vm_mark_label(vm);
+    inline_redefine(vm, a);
     vm->code[addr_ptr] = vm->codesz;
 }
 
@@ -676,11 +813,8 @@ void op_jmp(struct forthvm *vm)
 {
     vm->pc++;
     data addr = vm->code[vm->pc];
-    if (addr < 0) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "failed to jmp, invalid address";
-    }
+    if (addr < 0)
+        vm_error(vm, "failed to jmp, invalid address");
     vm->pc = addr - 1;
 }
 
@@ -688,13 +822,9 @@ void op_jz(struct forthvm *vm)
 {
     vm->pc++;
     data addr = vm->code[vm->pc];
-    if (addr < 0) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "failed to jz, invalid address";
-    }
+    if (addr < 0)
+        vm_error(vm, "failed to jz, invalid address");
     data d = vm_pop_ds(vm);
-    CHECKERR;
     if (d == 0)
         vm->pc = addr - 1;
 }
@@ -707,19 +837,7 @@ void op_exit(struct forthvm *vm)
 
 void op_execute(struct forthvm *vm)
 {
-    data entry = vm_pop_ds(vm);
-    CHECKERR;
-    if (entry <= OP_NOP) {
-        opfunc f = get_opfunc(entry);
-        (*f)(vm);
-        return;
-    }
-    data addr = vm->dict[entry];
-    if (addr < 0) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "undefined word";
-    }
+    data addr = vm_pop_ds(vm);
     vm_push_rs(vm, vm->pc);
     vm->pc = addr - 1;
 }
@@ -728,20 +846,16 @@ void op_cfunc(struct forthvm *vm)
 {
     vm->pc++;
     data addr = vm->code[vm->pc];
-    opfunc f = *(opfunc *)&addr;
+    opfunc f = VM_CFUNC(vm, addr);
     (*f)(vm);
 }
 
 void op_call(struct forthvm *vm)
 {
-    vm->pc++;
-    data entry = vm->code[vm->pc];
-    data addr = vm->dict[entry];
-    if (addr < 0) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "undefined word";
-    }
+    vm->pc += 2;
+    data addr = vm->code[vm->pc];
+    if (addr < 0)
+        vm_error(vm, "undefined word");
     vm_push_rs(vm, vm->pc);
     vm->pc = addr - 1;
 }
@@ -749,66 +863,334 @@ void op_call(struct forthvm *vm)
 void op_cells(struct forthvm *vm)
 {
     data a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a * sizeof(data));
 }
 
 void op_chars(struct forthvm *vm)
 {
     data a = vm_pop_ds(vm);
-    CHECKERR;
     vm_push_ds(vm, a * sizeof(char));
 }
 
 void op_allot(struct forthvm *vm)
 {
     data size = vm_pop_ds(vm);
-    CHECKERR;
     vm_heap_grow(vm, size);
-    CHECKERR;
 }
 
 void op_allocate(struct forthvm *vm)
 {
     data size = vm_pop_ds(vm);
-    CHECKERR;
-    void *buf = malloc(size);
-    vm_push_ds(vm, (data)buf);
-    CHECKERR;
+    vm_push_ds(vm, vm_allocate(vm, size));
 }
 
 void op_resize(struct forthvm *vm)
 {
-    CHECKDS(2);
     data size = vm_pop_ds(vm);
     data addr = vm_pop_ds(vm);
-    void *buf = (void *)addr;
-    buf = realloc(buf, size);
-    vm_push_ds(vm, (data)buf);
+    vm_push_ds(vm, vm_resize(vm, addr, size));
 }
 
 void op_free(struct forthvm *vm)
 {
     data addr = vm_pop_ds(vm);
-    CHECKERR;
-    void *buf = (void *)addr;
-    free(buf);
+    vm_free(vm, addr);
 }
 
 void op_bang(struct forthvm *vm)
 {
     data addr = vm_pop_ds(vm);
-    CHECKERR;
     data x = vm_pop_ds(vm);
-    CHECKERR;
-    *(data *)addr = x;
+    *(data *)VM_PTR(vm, addr) = x;
 }
 
 void op_at(struct forthvm *vm)
 {
     data addr = vm_pop_ds(vm);
-    CHECKERR;
-    vm_push_ds(vm, *(data *)addr);
+    vm_push_ds(vm, *(data *)VM_PTR(vm, addr));
+}
+
+void op_fusions(struct forthvm *vm) { fuse_report(vm); }
+
+void op_stackeffect(struct forthvm *vm)
+{
+    data entry = vm_read_word(vm);
+    effect_print(vm, entry);
+}
+
+void op_codesize(struct forthvm *vm)
+{
+    fprintf(vm->out, "code         %ld bytes\n",
+            (long)(vm->codesz * sizeof(data)));
+    fprintf(vm->out, "compact      %ld words, %ld bytes as cells, %ld bytes\n",
+            (long)vm->compactwords, (long)vm->compactfrom,
+            (long)vm->compactto);
+}
+
+void op_tiers(struct forthvm *vm) { tier_report(vm); }
+
+void op_relayout(struct forthvm *vm) { relayout(vm); }
+
+void op_memos(struct forthvm *vm) { memo_report(vm); }
+
+void op_addi(struct forthvm *vm)
+{
+    vm->pc++;
+    data n = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    vm_push_ds(vm, a + n);
+}
+
+void op_2dup(struct forthvm *vm)
+{
+    data a = vm->ds[vm->dsp - 1];
+    data b = vm->ds[vm->dsp];
+    vm_push_ds(vm, a);
+    vm_push_ds(vm, b);
+}
+
+// read the target of a fused conditional jump and take it if cond is false
+static void jump_unless(struct forthvm *vm, bool cond)
+{
+    vm->pc++;
+    data addr = vm->code[vm->pc];
+    if (addr < 0)
+        vm_error(vm, "failed to jz, invalid address");
+    if (!cond)
+        vm->pc = addr - 1;
+}
+
+void op_jnz(struct forthvm *vm)
+{
+    data d = vm_pop_ds(vm);
+    jump_unless(vm, d == 0);
+}
+
+void op_dupjz(struct forthvm *vm)
+{
+    jump_unless(vm, vm->ds[vm->dsp] != 0);
+}
+
+void op_dupjnz(struct forthvm *vm)
+{
+    jump_unless(vm, vm->ds[vm->dsp] == 0);
+}
+
+void op_eqjz(struct forthvm *vm)
+{
+    data b = vm_pop_ds(vm);
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a == b);
+}
+
+void op_neqjz(struct forthvm *vm)
+{
+    data b = vm_pop_ds(vm);
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a != b);
+}
+
+void op_ltjz(struct forthvm *vm)
+{
+    data b = vm_pop_ds(vm);
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a < b);
+}
+
+void op_gtjz(struct forthvm *vm)
+{
+    data b = vm_pop_ds(vm);
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a > b);
+}
+
+void op_lejz(struct forthvm *vm)
+{
+    data b = vm_pop_ds(vm);
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a <= b);
+}
+
+void op_gejz(struct forthvm *vm)
+{
+    data b = vm_pop_ds(vm);
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a >= b);
+}
+
+void op_eqijz(struct forthvm *vm)
+{
+    vm->pc++;
+    data b = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a == b);
+}
+
+void op_neqijz(struct forthvm *vm)
+{
+    vm->pc++;
+    data b = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a != b);
+}
+
+void op_ltijz(struct forthvm *vm)
+{
+    vm->pc++;
+    data b = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a < b);
+}
+
+void op_gtijz(struct forthvm *vm)
+{
+    vm->pc++;
+    data b = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a > b);
+}
+
+void op_leijz(struct forthvm *vm)
+{
+    vm->pc++;
+    data b = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a <= b);
+}
+
+void op_geijz(struct forthvm *vm)
+{
+    vm->pc++;
+    data b = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    jump_unless(vm, a >= b);
 }
 
 void op_nop(struct forthvm *vm) {}
+
+// pick with a literal index, compiled where the depth is known to be enough
+void op_picki(struct forthvm *vm)
+{
+    vm->pc++;
+    data n = vm->code[vm->pc];
+    vm_push_ds(vm, vm->ds[vm->dsp - n]);
+}
+
+// the depth check of a word, made once when it is entered
+void op_needs(struct forthvm *vm)
+{
+    vm->pc++;
+    data n = vm->code[vm->pc];
+    CHECKDS(n);
+}
+
+// A case table is n casej entries of a value and an address, sorted by
+// value, following the operand n. The top of the stack selects the address
+// of its entry, or the code past the table if it has none.
+void op_jtab(struct forthvm *vm)
+{
+    data n = vm->code[vm->pc + 1];
+    data *e = &vm->code[vm->pc + 2];
+    data k = vm->ds[vm->dsp] - e[1];
+    if (k >= 0 && k < n)
+        vm->pc = e[3 * k + 2] - 1;
+    else
+        vm->pc += 1 + 3 * n;
+}
+
+// the values of a btab may have gaps, it is searched by halves
+data btab_find(data *e, data n, data x)
+{
+    data lo = 0, hi = n;
+    while (lo < hi) {
+        data mid = lo + (hi - lo) / 2;
+        data v = e[3 * mid + 1];
+        if (v == x)
+            return mid;
+        if (v < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+void op_btab(struct forthvm *vm)
+{
+    data n = vm->code[vm->pc + 1];
+    data *e = &vm->code[vm->pc + 2];
+    data k = btab_find(e, n, vm->ds[vm->dsp]);
+    if (k >= 0)
+        vm->pc = e[3 * k + 2] - 1;
+    else
+        vm->pc += 1 + 3 * n;
+}
+
+// the entries are skipped by their table, never run
+void op_casej(struct forthvm *vm) { vm->pc += 2; }
+
+void op_tick(struct forthvm *vm)
+{
+    vm->pc++;
+    data entry = vm->code[vm->pc];
+    if (++vm->dicthits[entry] == vm->tierhot)
+        tier_promote(vm, entry);
+}
+
+// returns on a hit like exit
+void op_memo(struct forthvm *vm)
+{
+    vm->pc++;
+    if (memo_find(vm, vm->code[vm->pc]))
+        vm->pc = vm_pop_rs(vm);
+}
+
+void op_memosave(struct forthvm *vm)
+{
+    vm->pc++;
+    memo_save(vm, vm->code[vm->pc]);
+}
+
+// multiply by 2^n
+void op_shli(struct forthvm *vm)
+{
+    vm->pc++;
+    data n = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    vm_push_ds(vm, (uintptr_t)a << n);
+}
+
+// divide by 2^n, rounding toward zero as / does
+void op_shri(struct forthvm *vm)
+{
+    vm->pc++;
+    data n = vm->code[vm->pc];
+    data a = vm_pop_ds(vm);
+    vm_push_ds(vm, (a + (a < 0 ? ((data)1 << n) - 1 : 0)) >> n);
+}
+
+// call in tail position, the callee returns straight to our caller
+void op_tailcall(struct forthvm *vm)
+{
+    vm->pc += 2;
+    data addr = vm->code[vm->pc];
+    if (addr < 0)
+        vm_error(vm, "undefined word");
+    vm->pc = addr - 1;
+}
+
+// the body of a word compiled by the jit, the operand is its native code
+void op_native(struct forthvm *vm)
+{
+    vm->pc++;
+    data fn = vm->code[vm->pc];
+    jit_run(vm, (void *)(intptr_t)fn);
+}
+
+// the body of a word in compact form, the operand points at its bytes
+void op_compact(struct forthvm *vm)
+{
+    vm->pc++;
+    data p = vm->code[vm->pc];
+    compact_run(vm, (const uint8_t *)(intptr_t)p);
+}
@@ -18,6 +18,8 @@
 #ifndef REINFORTH_OPCODE_H_
 #define REINFORTH_OPCODE_H_
 
+#include <stdbool.h>
+
 #include "types.h"
 
 enum opcode {
@@ -80,6 +82,8 @@ enum opcode {
     OP_RAT,
     OP_EXECUTE,
     OP_QUOTE,
+    OP_DEFER,
+    OP_IS,
     OP_CFUNC,
     OP_DO,
     OP_LOOP,
@@ -87,7 +91,45 @@ enum opcode {
     OP_I,
     OP_II,
     OP_J,
+    OP_UNLOOP,
     OP_HEAPSIZE,
+    OP_FUSIONS,
+    OP_CODESIZE,
+    OP_STACKEFFECT,
+    OP_TIERS,
+    OP_RELAYOUT,
+    OP_MEMOS,
+    // superinstructions, only emitted by the compiler
+    OP_ADDI,
+    OP_2DUP,
+    OP_JNZ,
+    OP_DUPJZ,
+    OP_DUPJNZ,
+    OP_EQJZ,
+    OP_NEQJZ,
+    OP_LTJZ,
+    OP_GTJZ,
+    OP_LEJZ,
+    OP_GEJZ,
+    OP_EQIJZ,
+    OP_NEQIJZ,
+    OP_LTIJZ,
+    OP_GTIJZ,
+    OP_LEIJZ,
+    OP_GEIJZ,
+    OP_SHLI,
+    OP_SHRI,
+    OP_PICKI,
+    OP_NEEDS,
+    OP_JTAB,
+    OP_BTAB,
+    OP_CASEJ,
+    OP_TICK,
+    OP_MEMO,
+    OP_MEMOSAVE,
+    OP_TAILCALL,
+    OP_NATIVE,
+    OP_COMPACT,
     OP_NOP,
 };
 
@@ -99,8 +141,11 @@ void op_j(struct forthvm *vm);
 void op_do(struct forthvm *vm);
 void op_loop(struct forthvm *vm);
 void op_plusloop(struct forthvm *vm);
+void op_unloop(struct forthvm *vm);
 void op_execute(struct forthvm *vm);
 void op_quote(struct forthvm *vm);
+void op_defer(struct forthvm *vm);
+void op_is(struct forthvm *vm);
 void op_cfunc(struct forthvm *vm);
 void op_pick(struct forthvm *vm);
 void op_rpick(struct forthvm *vm);
@@ -160,9 +205,50 @@ void op_bang(struct forthvm *vm);
 void op_at(struct forthvm *vm);
 void op_print(struct forthvm *vm);
 void op_heapsize(struct forthvm *vm);
+void op_fusions(struct forthvm *vm);
+void op_codesize(struct forthvm *vm);
+void op_stackeffect(struct forthvm *vm);
+void op_tiers(struct forthvm *vm);
+void op_relayout(struct forthvm *vm);
+void op_memos(struct forthvm *vm);
+void op_addi(struct forthvm *vm);
+void op_2dup(struct forthvm *vm);
+void op_jnz(struct forthvm *vm);
+void op_dupjz(struct forthvm *vm);
+void op_dupjnz(struct forthvm *vm);
+void op_eqjz(struct forthvm *vm);
+void op_neqjz(struct forthvm *vm);
+void op_ltjz(struct forthvm *vm);
+void op_gtjz(struct forthvm *vm);
+void op_lejz(struct forthvm *vm);
+void op_gejz(struct forthvm *vm);
+void op_eqijz(struct forthvm *vm);
+void op_neqijz(struct forthvm *vm);
+void op_ltijz(struct forthvm *vm);
+void op_gtijz(struct forthvm *vm);
+void op_leijz(struct forthvm *vm);
+void op_geijz(struct forthvm *vm);
+void op_shli(struct forthvm *vm);
+void op_shri(struct forthvm *vm);
+void op_picki(struct forthvm *vm);
+void op_needs(struct forthvm *vm);
+void op_jtab(struct forthvm *vm);
+void op_btab(struct forthvm *vm);
+void op_casej(struct forthvm *vm);
+void op_tick(struct forthvm *vm);
+void op_memo(struct forthvm *vm);
+void op_memosave(struct forthvm *vm);
+void op_tailcall(struct forthvm *vm);
+void op_native(struct forthvm *vm);
+void op_compact(struct forthvm *vm);
 void op_nop(struct forthvm *vm);
 
 char *get_opname(enum opcode);
+int get_opargs(enum opcode op);
+bool is_jump(enum opcode op);
+bool get_opeffect(enum opcode op, int *in, int *out);
+// index of the casej entry of x in the n entries at e, or -1
+data btab_find(data *e, data n, data x);
 
 opfunc get_opfunc(enum opcode op);
 data get_opaddr(enum opcode op);
@@ -0,0 +1,195 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "peephole.h"
+
+#include <stdlib.h>
+
+#include "casetab.h"
+#include "fold.h"
+#include "insn.h"
+#include "unroll.h"
+#include "vm.h"
+
+// follow chains of unconditional jumps, a jmp landing on exit becomes exit
+static bool thread_jumps(struct insnlist *l)
+{
+    bool changed = false;
+    for (int i = 0; i < l->size; i++) {
+        struct insn *in = &l->buf[i];
+        data *t = insn_target(in);
+        if (in->dead || t == NULL)
+            continue;
+        // bounded so that a jump loop cannot hang the compiler
+        for (int n = 0; n < l->size; n++) {
+            int j = *t;
+            if (j < l->size && l->buf[j].dead)
+                j = insn_next(l, j);
+            if (j >= l->size || l->buf[j].op != OP_JMP || j == i) {
+                if (*t != j) {
+                    *t = j;
+                    changed = true;
+                }
+                break;
+            }
+            *t = l->buf[j].arg[0];
+            changed = true;
+        }
+        if (in->op == OP_JMP && *t < l->size && l->buf[*t].op == OP_EXIT) {
+            in->op = OP_EXIT;
+            changed = true;
+        } else if (in->op == OP_JMP && *t == insn_next(l, i)) {
+            in->dead = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static bool falls_through(enum opcode op)
+{
+    return op != OP_JMP && op != OP_EXIT;
+}
+
+static bool remove_unreachable(struct insnlist *l)
+{
+    bool changed = false;
+    bool *seen = calloc(l->size + 1, sizeof(bool));
+    int *work = malloc(sizeof(int) * (l->size + 1) * 2);
+    int nwork = 0;
+    work[nwork++] = 0;
+    while (nwork > 0) {
+        int i = work[--nwork];
+        if (i >= l->size || seen[i])
+            continue;
+        seen[i] = true;
+        struct insn *in = &l->buf[i];
+        data *t = insn_target(in);
+        if (t != NULL && !in->dead)
+            work[nwork++] = *t;
+        if (in->dead || falls_through(in->op))
+            work[nwork++] = i + 1;
+    }
+    for (int i = 0; i < l->size; i++) {
+        if (!seen[i] && !l->buf[i].dead) {
+            l->buf[i].dead = true;
+            changed = true;
+        }
+    }
+    free(seen);
+    free(work);
+    return changed;
+}
+
+static bool is_nop_pair(enum opcode a, enum opcode b)
+{
+    return (a == OP_SWAP && b == OP_SWAP) || (a == OP_DUP && b == OP_DROP) ||
+           (a == OP_D2R && b == OP_R2D);
+}
+
+static bool remove_pairs(struct insnlist *l)
+{
+    bool changed = false;
+    bool *label = calloc(l->size + 1, sizeof(bool));
+    for (int i = 0; i < l->size; i++) {
+        data *t = insn_target(&l->buf[i]);
+        if (!l->buf[i].dead && t != NULL)
+            label[*t] = true;
+    }
+    int i = insn_next(l, -1);
+    while (i < l->size) {
+        int j = insn_next(l, i);
+        if (j < l->size && !label[j] &&
+            is_nop_pair(l->buf[i].op, l->buf[j].op)) {
+            l->buf[i].dead = true;
+            l->buf[j].dead = true;
+            changed = true;
+            // the removal may have made a new pair around it
+            i = insn_next(l, -1);
+            continue;
+        }
+        i = j;
+    }
+    free(label);
+    return changed;
+}
+
+// the placeholders left by inline_call for empty words
+static bool remove_nops(struct insnlist *l)
+{
+    bool changed = false;
+    for (int i = 0; i < l->size; i++) {
+        if (!l->buf[i].dead && l->buf[i].op == OP_NOP) {
+            l->buf[i].dead = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// a call followed by exit becomes a jump to the callee through the dict, the
+// exit stays for code that copies the body with inline_call
+static bool tail_calls(struct insnlist *l)
+{
+    bool changed = false;
+    for (int i = 0; i < l->size; i++) {
+        int j = insn_next(l, i);
+        if (l->buf[i].dead || l->buf[i].op != OP_CALL || j >= l->size)
+            continue;
+        if (l->buf[j].op == OP_EXIT) {
+            l->buf[i].op = OP_TAILCALL;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void peephole(struct forthvm *vm, data start)
+{
+    struct insnlist l;
+    insn_init(&l);
+    if (insn_decode(vm, &l, start, vm->codesz) < 0) {
+        insn_free(&l);
+        return;
+    }
+    bool changed = false;
+    bool again = true;
+    while (again) {
+        again = false;
+        if (vm->opts & OPT_PEEPHOLE) {
+            again |= thread_jumps(&l);
+            again |= remove_unreachable(&l);
+            again |= remove_pairs(&l);
+            again |= remove_nops(&l);
+        }
+        if (vm->opts & OPT_FOLD)
+            again |= fold_constants(&l);
+        if (vm->opts & OPT_TAILCALL)
+            again |= tail_calls(&l);
+        if (vm->opts & OPT_UNROLL)
+            again |= unroll_loops(&l, vm->unrollmax);
+        if (vm->opts & OPT_CASETAB)
+            again |= case_tables(&l);
+        changed |= again;
+    }
+    if (changed) {
+        vm->codesz = start;
+        vm_mark_label(vm);
+        insn_encode(vm, &l);
+    }
+    insn_free(&l);
+}
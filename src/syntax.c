@@ -17,18 +17,15 @@
 
 #include "syntax.h"
 
-#include <string.h>
-
+#include "inline.h"
+#include "memo.h"
 #include "opcode.h"
+#include "tier.h"
 #include "vm.h"
 
 #define CHECKCOMPILE                                                           \
-    if (vm->ready) {                                                           \
-        vm->finished = true;                                                   \
-        vm->ret = -1;                                                          \
-        vm->errmsg = "invalid word during interpreting";                       \
-        return;                                                                \
-    }
+    if (vm->ready)                                                             \
+    vm_error(vm, "invalid word during interpreting")
 
 char *syntax_name[SYN_NOP] = {
     [SYN_COLON] = ":",     [SYN_SEMI] = ";",         [SYN_BEGIN] = "begin",
@@ -36,6 +33,9 @@ char *syntax_name[SYN_NOP] = {
     [SYN_THEN] = "then",   [SYN_DO] = "do",          [SYN_LEAVE] = "leave",
     [SYN_LOOP] = "loop",   [SYN_PLUSLOOP] = "+loop", [SYN_AGAIN] = "again",
     [SYN_WHILE] = "while", [SYN_REPEAT] = "repeat",
+    [SYN_NOINLINE] = "noinline", [SYN_CASE] = "case",    [SYN_OF] = "of",
+    [SYN_ENDOF] = "endof", [SYN_ENDCASE] = "endcase",
+    [SYN_MEMOIZE] = "memoize",
 };
 
 opfunc syntax_ops[SYN_NOP + 1] = {
@@ -46,19 +46,12 @@ opfunc syntax_ops[SYN_NOP + 1] = {
     [SYN_ELSE] = syn_else,         [SYN_THEN] = syn_then,
     [SYN_NOP] = syn_nop,           [SYN_DO] = syn_do,
     [SYN_LEAVE] = syn_leave,       [SYN_LOOP] = syn_loop,
-    [SYN_PLUSLOOP] = syn_plusloop,
+    [SYN_PLUSLOOP] = syn_plusloop, [SYN_NOINLINE] = syn_noinline,
+    [SYN_CASE] = syn_case,         [SYN_OF] = syn_of,
+    [SYN_ENDOF] = syn_endof,       [SYN_ENDCASE] = syn_endcase,
+    [SYN_MEMOIZE] = syn_memoize,
 };
 
-int get_syntax(char *word)
-{
-    for (int i = 0; i < SYN_NOP; i++) {
-        if (strcmp(word, syntax_name[i]) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
 opfunc get_syntax_op(enum syntax s)
 {
     if (s > SYN_NOP)
@@ -68,17 +61,29 @@ opfunc get_syntax_op(enum syntax s)
 
 void syn_nop(struct forthvm *vm) {}
 
+// count a call or a trip of a first tier word
+static void tick(struct forthvm *vm)
+{
+    if (vm->dicttier[vm->lastword] != TIER_BASE)
+        return;
+    vm_emit_opcode(vm, OP_TICK);
+    vm_emit_data(vm, vm->lastword);
+}
+
 void syn_colon(struct forthvm *vm)
 {
     vm_execute(vm);
-    if (vm->rsp > 0) {
-        vm->errmsg = "wrong place to start word definition";
-        vm->finished = true;
-        vm->ret = -1;
-        return;
-    }
+    if (vm->rsp > 0)
+        vm_error(vm, "wrong place to start word definition");
     data entry = vm_read_word(vm);
-    vm->dict[entry] = vm->codesz;
+    vm_mark_label(vm);
+    vm_define(vm, entry, vm->codesz);
+    vm->lastword = entry;
+    vm->ncopies = 0;
+    vm->dicthits[entry] = 0;
+    vm->dicttier[entry] = vm->opts & OPT_TIER ? TIER_BASE : TIER_OPT;
+    tick(vm);
+    vm_push_rs(vm, entry);
     vm_push_rs(vm, SYN_COLON);
     vm->ready = false;
 }
@@ -86,15 +91,17 @@ void syn_colon(struct forthvm *vm)
 void syn_semi(struct forthvm *vm)
 {
     enum syntax s = vm_pop_rs(vm);
-    if (vm->finished)
-        return;
-    if (s != SYN_COLON) {
-        vm->errmsg = "expect semicolon";
-        vm->finished = true;
-        vm->ret = -1;
-        return;
-    }
+    if (s != SYN_COLON)
+        vm_error(vm, "expect semicolon");
+    data entry = vm_pop_rs(vm);
     vm_emit_opcode(vm, OP_EXIT);
+    vm_mark_label(vm);
+    // a first tier word is compiled again once hot
+    vm->dictend[entry] = vm->codesz;
+    inline_finish(vm, entry);
+    if (vm->dicttier[entry] != TIER_BASE)
+        tier_compile(vm, entry);
+    inline_redefine(vm, entry);
     vm->pc = vm->codesz;
     vm->ready = true;
 }
@@ -110,17 +117,14 @@ void syn_if(struct forthvm *vm)
 void syn_else(struct forthvm *vm)
 {
     data d = vm_pop_rs(vm);
-    if (d != SYN_IF || vm->finished) {
-        vm->errmsg = "unexpected else";
-        vm->finished = true;
-        vm->ret = -1;
-        return;
-    }
+    if (d != SYN_IF)
+        vm_error(vm, "unexpected else");
     d = vm_pop_rs(vm);
     vm_emit_opcode(vm, OP_JMP);
     vm_push_rs(vm, vm->codesz);
     vm_push_rs(vm, SYN_ELSE);
-    vm_emit_opcode(vm, -1);
+    vm_emit_data(vm, -1);
+    vm_mark_label(vm);
     vm->code[d] = vm->codesz;
 }
 
@@ -133,92 +137,66 @@ void syn_do(struct forthvm *vm)
     vm_emit_opcode(vm, OP_DO);
     vm_push_rs(vm, vm->codesz);
     vm_emit_data(vm, -1);
+    vm_mark_label(vm);
+    tick(vm);
     vm_push_rs(vm, SYN_DO);
 }
 
 void syn_leave(struct forthvm *vm)
 {
     CHECKCOMPILE;
-    if (vm->rs[vm->rsp] != SYN_DO && vm->rs[vm->rsp] != SYN_LEAVE) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "not a do loop, cannot leave";
-        return;
-    }
+    if (vm->rs[vm->rsp] != SYN_DO && vm->rs[vm->rsp] != SYN_LEAVE)
+        vm_error(vm, "not a do loop, cannot leave");
     vm_emit_opcode(vm, OP_JMP);
     vm_push_rs(vm, vm->codesz);
     vm_emit_data(vm, -1);
     vm_push_rs(vm, SYN_LEAVE);
 }
 
-void syn_loop(struct forthvm *vm)
+// loop and +loop step the index and branch back while it is below the
+// limit, falling out to the end where leave also goes
+static void close_loop(struct forthvm *vm, enum opcode op, char *msg)
 {
-    CHECKCOMPILE;
-    vm_emit_opcode(vm, OP_LOOP);
-    vm_emit_opcode(vm, OP_JMP);
-    data begin_pos_ptr = vm->codesz;
+    vm_emit_opcode(vm, op);
+    data back_ptr = vm->codesz;
     vm_emit_data(vm, -1);
+    vm_mark_label(vm);
     data end = vm->codesz;
     while (1) {
         data ins = vm_pop_rs(vm);
         if (ins == SYN_DO) {
             data begin_pos = vm_pop_rs(vm);
-            vm->code[begin_pos_ptr] = begin_pos - 1;
+            vm->code[back_ptr] = begin_pos + 1;
             vm->code[begin_pos] = end;
-            vm_emit_opcode(vm, OP_R2D);
-            vm_emit_opcode(vm, OP_DROP);
-            vm_emit_opcode(vm, OP_R2D);
-            vm_emit_opcode(vm, OP_DROP);
+            vm_emit_opcode(vm, OP_UNLOOP);
             break;
         }
         if (ins == SYN_LEAVE) {
             vm->code[vm_pop_rs(vm)] = end;
             continue;
-        } else {
-            vm->finished = true;
-            vm->ret = -1;
-            vm->errmsg = "unexpected loop";
-            return;
         }
+        vm_error(vm, msg);
     }
 }
 
+void syn_loop(struct forthvm *vm)
+{
+    CHECKCOMPILE;
+    close_loop(vm, OP_LOOP, "unexpected loop");
+}
+
 void syn_plusloop(struct forthvm *vm)
 {
     CHECKCOMPILE;
-    vm_emit_opcode(vm, OP_PLUSLOOP);
-    vm_emit_opcode(vm, OP_JMP);
-    data begin_pos_ptr = vm->codesz;
-    vm_emit_data(vm, -1);
-    data end = vm->codesz;
-    while (1) {
-        data ins = vm_pop_rs(vm);
-        if (ins == SYN_DO) {
-            data begin_pos = vm_pop_rs(vm);
-            vm->code[begin_pos_ptr] = begin_pos - 1;
-            vm->code[begin_pos] = end;
-            vm_emit_opcode(vm, OP_R2D);
-            vm_emit_opcode(vm, OP_DROP);
-            vm_emit_opcode(vm, OP_R2D);
-            vm_emit_opcode(vm, OP_DROP);
-            break;
-        }
-        if (ins == SYN_LEAVE) {
-            vm->code[vm_pop_rs(vm)] = end;
-            continue;
-        } else {
-            vm->finished = true;
-            vm->ret = -1;
-            vm->errmsg = "unexpected +loop";
-            return;
-        }
-    }
+    close_loop(vm, OP_PLUSLOOP, "unexpected +loop");
 }
 
 void syn_begin(struct forthvm *vm)
 {
     CHECKCOMPILE;
+    vm_mark_label(vm);
     vm_push_rs(vm, vm->codesz);
+    tick(vm);
     vm_push_rs(vm, SYN_BEGIN);
 }
 
@@ -226,12 +204,8 @@ void syn_again(struct forthvm *vm)
 {
     CHECKCOMPILE;
     data syntok = vm_pop_rs(vm);
-    if (syntok != SYN_BEGIN) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "syntax error, unexpected again";
-        return;
-    }
+    if (syntok != SYN_BEGIN)
+        vm_error(vm, "syntax error, unexpected again");
     data addr = vm_pop_rs(vm);
     vm_emit_opcode(vm, OP_JMP);
     vm_emit_data(vm, addr);
@@ -241,12 +215,8 @@ void syn_until(struct forthvm *vm)
 {
     CHECKCOMPILE;
     data syntok = vm_pop_rs(vm);
-    if (syntok != SYN_BEGIN) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "syntax error, unexpected until";
-        return;
-    }
+    if (syntok != SYN_BEGIN)
+        vm_error(vm, "syntax error, unexpected until");
     data addr = vm_pop_rs(vm);
     vm_emit_opcode(vm, OP_JZ);
     vm_emit_data(vm, addr);
@@ -256,12 +226,8 @@ void syn_while(struct forthvm *vm)
 {
     CHECKCOMPILE;
     data syntok = vm->rs[vm->rsp];
-    if (syntok != SYN_BEGIN) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "syntax error, unexpected while";
-        return;
-    }
+    if (syntok != SYN_BEGIN)
+        vm_error(vm, "syntax error, unexpected while");
     vm_emit_opcode(vm, OP_JZ);
     vm_push_rs(vm, vm->codesz);
     vm_emit_data(vm, -1);
@@ -272,41 +238,98 @@ void syn_repeat(struct forthvm *vm)
 {
     CHECKCOMPILE;
     data syntok = vm_pop_rs(vm);
-    if (syntok != SYN_WHILE) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "syntax error, unexpected repeat";
-        return;
-    }
+    if (syntok != SYN_WHILE)
+        vm_error(vm, "syntax error, unexpected repeat");
     data addr = vm_pop_rs(vm);
     vm->code[addr] = vm->codesz + 2;
 
     syntok = vm_pop_rs(vm);
-    if (syntok != SYN_BEGIN) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "syntax error, unexpected repeat";
-        return;
-    }
+    if (syntok != SYN_BEGIN)
+        vm_error(vm, "syntax error, unexpected repeat");
     addr = vm_pop_rs(vm);
     vm_emit_opcode(vm, OP_JMP);
     vm_emit_data(vm, addr);
+    vm_mark_label(vm);
 }
 
 void syn_then(struct forthvm *vm)
 {
     data d = vm_pop_rs(vm);
-    if (vm->finished)
-        return;
-    if (d != SYN_IF && d != SYN_ELSE) {
-        vm->errmsg = "expect if or else before then";
-        vm->finished = true;
-        vm->ret = -1;
-        return;
-    }
+    if (d != SYN_IF && d != SYN_ELSE)
+        vm_error(vm, "expect if or else before then");
     d = vm_pop_rs(vm);
-    if (vm->finished) {
-        return;
-    }
+    vm_mark_label(vm);
+    vm->code[d] = vm->codesz;
+}
+
+// case compiles to a chain of over = if drop ... else, the peephole pass
+// turns chains of literals into a table
+void syn_case(struct forthvm *vm)
+{
+    CHECKCOMPILE;
+    vm_push_rs(vm, 0);
+    vm_push_rs(vm, SYN_CASE);
+}
+
+void syn_of(struct forthvm *vm)
+{
+    CHECKCOMPILE;
+    data d = vm->rs[vm->rsp];
+    if (d != SYN_CASE && d != SYN_ENDOF)
+        vm_error(vm, "unexpected of");
+    vm_emit_opcode(vm, OP_OVER);
+    vm_emit_opcode(vm, OP_EQ);
+    vm_emit_opcode(vm, OP_JZ);
+    vm_push_rs(vm, vm->codesz);
+    vm_emit_data(vm, -1);
+    vm_push_rs(vm, SYN_OF);
+    vm_emit_opcode(vm, OP_DROP);
+}
+
+void syn_endof(struct forthvm *vm)
+{
+    CHECKCOMPILE;
+    if (vm_pop_rs(vm) != SYN_OF)
+        vm_error(vm, "unexpected endof");
+    data d = vm_pop_rs(vm);
+    vm_emit_opcode(vm, OP_JMP);
+    vm_push_rs(vm, vm->codesz);
+    vm_emit_data(vm, -1);
+    vm_push_rs(vm, SYN_ENDOF);
+    vm_mark_label(vm);
     vm->code[d] = vm->codesz;
 }
+
+void syn_endcase(struct forthvm *vm)
+{
+    CHECKCOMPILE;
+    vm_emit_opcode(vm, OP_DROP);
+    vm_mark_label(vm);
+    while (1) {
+        data d = vm_pop_rs(vm);
+        if (d == SYN_CASE) {
+            vm_pop_rs(vm);
+            break;
+        }
+        if (d != SYN_ENDOF)
+            vm_error(vm, "unexpected endcase");
+        vm->code[vm_pop_rs(vm)] = vm->codesz;
+    }
+}
+
+// keep calls to the last defined word, used after its ;
+void syn_noinline(struct forthvm *vm)
+{
+    if (vm->lastword < 0)
+        vm_error(vm, "no word to mark noinline");
+    vm->dictflags[vm->lastword] |= WORD_NOINLINE;
+}
+
+// cache the results of the last defined word by its arguments, used after
+// its ; on words whose result depends on nothing else
+void syn_memoize(struct forthvm *vm)
+{
+    if (vm->lastword < 0 || !vm->ready)
+        vm_error(vm, "no word to memoize");
+    memo_declare(vm, vm->lastword);
+}
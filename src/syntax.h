@@ -31,14 +31,19 @@ enum syntax {
     SYN_IF,
     SYN_ELSE,
     SYN_THEN,
+    SYN_CASE,
+    SYN_OF,
+    SYN_ENDOF,
+    SYN_ENDCASE,
     SYN_DO,
     SYN_LEAVE,
     SYN_LOOP,
     SYN_PLUSLOOP,
+    SYN_NOINLINE,
+    SYN_MEMOIZE,
     SYN_NOP,
 };
 
-int get_syntax(char *word);
 opfunc get_syntax_op(enum syntax);
 
 void syn_colon(struct forthvm *vm);
@@ -51,10 +56,16 @@ void syn_repeat(struct forthvm *vm);
 void syn_if(struct forthvm *vm);
 void syn_else(struct forthvm *vm);
 void syn_then(struct forthvm *vm);
+void syn_case(struct forthvm *vm);
+void syn_of(struct forthvm *vm);
+void syn_endof(struct forthvm *vm);
+void syn_endcase(struct forthvm *vm);
 void syn_do(struct forthvm *vm);
 void syn_leave(struct forthvm *vm);
 void syn_loop(struct forthvm *vm);
 void syn_plusloop(struct forthvm *vm);
+void syn_noinline(struct forthvm *vm);
+void syn_memoize(struct forthvm *vm);
 void syn_nop(struct forthvm *vm);
 
 #endif
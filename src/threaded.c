@@ -0,0 +1,204 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "threaded.h"
+
+#ifdef __GNUC__
+
+#include "compact.h"
+#include "jit.h"
+#include "memo.h"
+#include "opcode.h"
+#include "tier.h"
+#include "vm.h"
+
+struct engine_tables {
+    data *optab;
+    data haltcell;
+};
+
+// pc, stack pointers and stack bases live in locals while running, they are
+// written back before calling out to C and reloaded afterwards because the
+// callee may grow the code.
+//
+// sp is always ds + depth. Without top of stack caching sp points at the top
+// element, with it the top element lives in the local tos and the cell at sp
+// is stale until SAVE spills it. TOS, S(n) for the nth element below the
+// top, PUSH_ and DROPN hide the difference from the handlers.
+//
+// Stacks are fixed and sit between guard pages, see vm_stacksz. Pushing past
+// the end or reading below the bottom faults and vm_run reports the error,
+// so handlers only need to read the deepest element they use. Those that
+// only touch the top call TOUCH first since a cached top is never read from
+// memory.
+#define SAVE()                                                                 \
+    do {                                                                       \
+        SPILL();                                                               \
+        vm->pc = ip - code;                                                    \
+        vm->dsp = sp - ds;                                                     \
+        vm->rsp = rp - rs;                                                     \
+    } while (0)
+
+#define LOAD()                                                                 \
+    do {                                                                       \
+        code = vm->code;                                                       \
+        ip = code + vm->pc;                                                    \
+        ds = vm->ds;                                                           \
+        sp = ds + vm->dsp;                                                     \
+        rs = vm->rs;                                                           \
+        rp = rs + vm->rsp;                                                     \
+        FILL();                                                                \
+    } while (0)
+
+#define S(n) sp[-(n)]
+#define PICK(n) ((n) == 0 ? TOS : S(n))
+
+// code cells are label addresses, or opcodes when those don't fit, with
+// the halt label after the last
+#if CELL_BITS == 32
+#define LABEL(cell) labels[cell]
+#else
+#define LABEL(cell) (void *)(cell)
+#endif
+
+#define NEXT goto *LABEL(*++ip)
+
+#define FAIL(msg)                                                              \
+    do {                                                                       \
+        SAVE();                                                                \
+        vm_error(vm, msg);                                                     \
+    } while (0)
+
+// for pick and rpick, whose index may jump over the guard page
+#define CHECKDS(len)                                                           \
+    if (sp - ds < (len))                                                       \
+    FAIL("no enough element on data stack")
+
+#define CHECKRS(len)                                                           \
+    if (rp - rs < (len))                                                       \
+    FAIL("no enough element on return stack")
+
+// fault now if the stack is empty
+#define TOUCH() ((void)*(volatile data *)sp)
+
+#define PUSH(x)                                                                \
+    do {                                                                       \
+        data x_ = (x);                                                         \
+        PUSH_(x_);                                                             \
+    } while (0)
+
+#define POP(v)                                                                 \
+    do {                                                                       \
+        v = TOS;                                                               \
+        DROPN(1);                                                              \
+    } while (0)
+
+#define PUSHR(x)                                                               \
+    do {                                                                       \
+        data x_ = (x);                                                         \
+        *++rp = x_;                                                            \
+    } while (0)
+
+// binary operator, a is the second element and b the top
+#define BINOP(expr)                                                            \
+    do {                                                                       \
+        b = TOS;                                                               \
+        a = S(1);                                                              \
+        sp--;                                                                  \
+        TOS = (expr);                                                          \
+    } while (0)
+
+#define UNOP(expr)                                                             \
+    do {                                                                       \
+        TOUCH();                                                               \
+        a = TOS;                                                               \
+        TOS = (expr);                                                          \
+    } while (0)
+
+// fused compare and jump, taken when the comparison is false
+#define CMPJZ(cond)                                                            \
+    do {                                                                       \
+        b = TOS;                                                               \
+        a = S(1);                                                              \
+        DROPN(2);                                                              \
+        JUMPUNLESS(cond);                                                      \
+    } while (0)
+
+#define CMPIJZ(cond)                                                           \
+    do {                                                                       \
+        b = *++ip;                                                             \
+        POP(a);                                                                \
+        JUMPUNLESS(cond);                                                      \
+    } while (0)
+
+#define JUMPUNLESS(cond)                                                       \
+    do {                                                                       \
+        data addr_ = *++ip;                                                    \
+        if (addr_ < 0)                                                         \
+            FAIL("failed to jz, invalid address");                             \
+        if (!(cond))                                                           \
+            ip = code + addr_ - 1;                                             \
+    } while (0)
+
+// call the handler from opcode.c for everything not worth inlining, it
+// does not return if it stops the vm
+#define SLOW(f)                                                                \
+    do {                                                                       \
+        SAVE();                                                                \
+        (f)(vm);                                                               \
+        LOAD();                                                                \
+    } while (0)
+
+// the engine body is instantiated once per stack layout
+#define ENGINE_EXECUTE threaded_execute
+#define ENGINE_OPTAB threaded_optab
+#define ENGINE_HALTCELL threaded_haltcell
+#define ENGINE_TABLES threaded_tables
+#define TOSCACHE 0
+#define TOS sp[0]
+#define SPILL()
+#define FILL()
+#define PUSH_(x) (*++sp = (x))
+#define DROPN(n) (sp -= (n))
+#include "threaded_impl.h"
+#undef ENGINE_EXECUTE
+#undef ENGINE_OPTAB
+#undef ENGINE_HALTCELL
+#undef ENGINE_TABLES
+#undef TOSCACHE
+#undef TOS
+#undef SPILL
+#undef FILL
+#undef PUSH_
+#undef DROPN
+
+#define ENGINE_EXECUTE tos_execute
+#define ENGINE_OPTAB tos_optab
+#define ENGINE_HALTCELL tos_haltcell
+#define ENGINE_TABLES tos_tables
+#define TOSCACHE 1
+#define TOS tos
+// an empty stack has no cell to hold the stale top, ds[0] is in the guard
+// page, so it goes to a local instead
+#define TOSCELL (sp == ds ? &scratch : sp)
+#define SPILL() (*TOSCELL = tos)
+#define FILL() (tos = *TOSCELL)
+#define PUSH_(x) (SPILL(), sp++, tos = (x))
+#define DROPN(n) (sp -= (n), FILL())
+#include "threaded_impl.h"
+
+#endif
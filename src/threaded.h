@@ -0,0 +1,36 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_THREADED_H_
+#define REINFORTH_THREADED_H_
+
+#include "types.h"
+
+struct forthvm;
+
+// direct-threaded engines built on labels-as-values, code cells hold the
+// address of the handler label instead of an opfunc
+data threaded_execute(struct forthvm *vm);
+data *threaded_optab(void);
+data threaded_haltcell(void);
+
+// same engine keeping the top of the data stack in a register
+data tos_execute(struct forthvm *vm);
+data *tos_optab(void);
+data tos_haltcell(void);
+
+#endif
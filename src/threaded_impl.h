@@ -0,0 +1,588 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// body of a threaded engine, included by threaded.c once per stack layout
+// with ENGINE_EXECUTE, ENGINE_OPTAB, ENGINE_HALTCELL, ENGINE_TABLES,
+// TOSCACHE and the stack access macros defined, there is no include guard
+// on purpose
+
+static struct engine_tables ENGINE_TABLES;
+
+data ENGINE_EXECUTE(struct forthvm *vm)
+{
+    static void *labels[OP_NOP + 2] = {
+        [OP_ADD] = &&op_add,
+        [OP_MINUS] = &&op_minus,
+        [OP_MUL] = &&op_mul,
+        [OP_DIV] = &&op_div,
+        [OP_MOD] = &&op_mod,
+        [OP_DIVMOD] = &&op_divmod,
+        [OP_MIN] = &&op_min,
+        [OP_MAX] = &&op_max,
+        [OP_NEGATE] = &&op_negate,
+        [OP_EQ] = &&op_eq,
+        [OP_NEQ] = &&op_neq,
+        [OP_GT] = &&op_gt,
+        [OP_LT] = &&op_lt,
+        [OP_GE] = &&op_ge,
+        [OP_LE] = &&op_le,
+        [OP_AND] = &&op_and,
+        [OP_OR] = &&op_or,
+        [OP_NOT] = &&op_not,
+        [OP_BITAND] = &&op_bitand,
+        [OP_BITOR] = &&op_bitor,
+        [OP_INVERT] = &&op_invert,
+        [OP_XOR] = &&op_xor,
+        [OP_DUP] = &&op_dup,
+        [OP_OVER] = &&op_over,
+        [OP_SWAP] = &&op_swap,
+        [OP_DROP] = &&op_drop,
+        [OP_DOT] = &&op_dot,
+        [OP_CALL] = &&op_call,
+        [OP_PUSH] = &&op_push,
+        [OP_CREATE] = &&op_create,
+        [OP_BYE] = &&op_bye,
+        [OP_EXIT] = &&op_exit,
+        [OP_JMP] = &&op_jmp,
+        [OP_JZ] = &&op_jz,
+        [OP_CELLS] = &&op_cells,
+        [OP_CHARS] = &&op_chars,
+        [OP_ALLOT] = &&op_allot,
+        [OP_ALLOCATE] = &&op_allocate,
+        [OP_RESIZE] = &&op_resize,
+        [OP_FREE] = &&op_free,
+        [OP_BANG] = &&op_bang,
+        [OP_AT] = &&op_at,
+        [OP_COMMA] = &&op_comma,
+        [OP_HERE] = &&op_here,
+        [OP_CR] = &&op_cr,
+        [OP_PRINT] = &&op_print,
+        [OP_EMIT] = &&op_emit,
+        [OP_ASSERT] = &&op_assert,
+        [OP_ROT] = &&op_rot,
+        [OP_DUMP] = &&op_dump,
+        [OP_RDUMP] = &&op_rdump,
+        [OP_DEPTH] = &&op_depth,
+        [OP_PICK] = &&op_pick,
+        [OP_RPICK] = &&op_rpick,
+        [OP_D2R] = &&op_d2r,
+        [OP_R2D] = &&op_r2d,
+        [OP_RAT] = &&op_rat,
+        [OP_EXECUTE] = &&op_execute,
+        [OP_QUOTE] = &&op_quote,
+        [OP_DEFER] = &&op_defer,
+        [OP_IS] = &&op_is,
+        [OP_CFUNC] = &&op_cfunc,
+        [OP_DO] = &&op_do,
+        [OP_LOOP] = &&op_loop,
+        [OP_PLUSLOOP] = &&op_plusloop,
+        [OP_UNLOOP] = &&op_unloop,
+        [OP_I] = &&op_i,
+        [OP_II] = &&op_ii,
+        [OP_J] = &&op_j,
+        [OP_HEAPSIZE] = &&op_heapsize,
+        [OP_FUSIONS] = &&op_fusions,
+        [OP_CODESIZE] = &&op_codesize,
+        [OP_STACKEFFECT] = &&op_stackeffect,
+        [OP_TIERS] = &&op_tiers,
+        [OP_RELAYOUT] = &&op_relayout,
+        [OP_MEMOS] = &&op_memos,
+        [OP_ADDI] = &&op_addi,
+        [OP_2DUP] = &&op_2dup,
+        [OP_JNZ] = &&op_jnz,
+        [OP_DUPJZ] = &&op_dupjz,
+        [OP_DUPJNZ] = &&op_dupjnz,
+        [OP_EQJZ] = &&op_eqjz,
+        [OP_NEQJZ] = &&op_neqjz,
+        [OP_LTJZ] = &&op_ltjz,
+        [OP_GTJZ] = &&op_gtjz,
+        [OP_LEJZ] = &&op_lejz,
+        [OP_GEJZ] = &&op_gejz,
+        [OP_EQIJZ] = &&op_eqijz,
+        [OP_NEQIJZ] = &&op_neqijz,
+        [OP_LTIJZ] = &&op_ltijz,
+        [OP_GTIJZ] = &&op_gtijz,
+        [OP_LEIJZ] = &&op_leijz,
+        [OP_GEIJZ] = &&op_geijz,
+        [OP_SHLI] = &&op_shli,
+        [OP_SHRI] = &&op_shri,
+        [OP_PICKI] = &&op_picki,
+        [OP_NEEDS] = &&op_needs,
+        [OP_JTAB] = &&op_jtab,
+        [OP_BTAB] = &&op_btab,
+        [OP_CASEJ] = &&op_casej,
+        [OP_TICK] = &&op_tick,
+        [OP_MEMO] = &&op_memo,
+        [OP_MEMOSAVE] = &&op_memosave,
+        [OP_TAILCALL] = &&op_tailcall,
+        [OP_NATIVE] = &&op_native,
+        [OP_COMPACT] = &&op_compact,
+        [OP_NOP] = &&op_nop,
+        [OP_NOP + 1] = &&halt,
+    };
+
+    if (vm == NULL) {
+        ENGINE_TABLES.optab = (data *)labels;
+        ENGINE_TABLES.haltcell = (data)(intptr_t) && halt;
+        return 0;
+    }
+
+    data *code, *ip;
+    data *ds, *sp;
+    data *rs, *rp;
+    data a, b;
+#if TOSCACHE
+    data tos, scratch;
+#endif
+
+    LOAD();
+    goto *LABEL(*ip);
+
+op_add:
+    BINOP(a + b);
+    NEXT;
+op_minus:
+    BINOP(a - b);
+    NEXT;
+op_mul:
+    BINOP(a * b);
+    NEXT;
+op_div:
+    BINOP(a / b);
+    NEXT;
+op_mod:
+    BINOP(a % b);
+    NEXT;
+op_divmod:
+    b = TOS;
+    a = S(1);
+    S(1) = a % b;
+    TOS = a / b;
+    NEXT;
+op_min:
+    BINOP(a < b ? a : b);
+    NEXT;
+op_max:
+    BINOP(a > b ? a : b);
+    NEXT;
+op_negate:
+    UNOP(-a);
+    NEXT;
+op_eq:
+    BINOP(a == b ? -1 : 0);
+    NEXT;
+op_neq:
+    BINOP(a == b ? 0 : -1);
+    NEXT;
+op_gt:
+    BINOP(a > b ? -1 : 0);
+    NEXT;
+op_lt:
+    BINOP(a < b ? -1 : 0);
+    NEXT;
+op_ge:
+    BINOP(a >= b ? -1 : 0);
+    NEXT;
+op_le:
+    BINOP(a <= b ? -1 : 0);
+    NEXT;
+op_and:
+    BINOP(a && b ? -1 : 0);
+    NEXT;
+op_or:
+    BINOP(a || b ? -1 : 0);
+    NEXT;
+op_not:
+    UNOP(a ? 0 : -1);
+    NEXT;
+op_bitand:
+    BINOP(a & b);
+    NEXT;
+op_bitor:
+    BINOP(a | b);
+    NEXT;
+op_invert:
+    UNOP(~a);
+    NEXT;
+op_xor:
+    BINOP(a ^ b);
+    NEXT;
+op_dup:
+    TOUCH();
+    PUSH(TOS);
+    NEXT;
+op_over:
+    PUSH(S(1));
+    NEXT;
+op_swap:
+    a = TOS;
+    TOS = S(1);
+    S(1) = a;
+    NEXT;
+op_drop:
+    TOUCH();
+    DROPN(1);
+    NEXT;
+op_rot:
+    a = S(2);
+    S(2) = S(1);
+    S(1) = TOS;
+    TOS = a;
+    NEXT;
+op_pick:
+    POP(a);
+    // a + 1 cells, ds[0] only faults in the build without a cached top
+    CHECKDS(a + 1);
+    PUSH(PICK(a));
+    NEXT;
+op_rpick:
+    POP(a);
+    CHECKRS(a);
+    PUSH(rp[-a]);
+    NEXT;
+op_depth:
+    PUSH(sp - ds);
+    NEXT;
+op_push:
+    PUSH(*++ip);
+    NEXT;
+op_jmp:
+    a = *++ip;
+    if (a < 0)
+        FAIL("failed to jmp, invalid address");
+    ip = code + a - 1;
+    NEXT;
+op_jz:
+    a = *++ip;
+    if (a < 0)
+        FAIL("failed to jz, invalid address");
+    POP(b);
+    if (b == 0)
+        ip = code + a - 1;
+    NEXT;
+op_call:
+    ip += 2;
+    a = *ip;
+    if (a < 0)
+        FAIL("undefined word");
+    PUSHR(ip - code);
+    ip = code + a - 1;
+    NEXT;
+op_exit:
+    ip = code + *rp--;
+    NEXT;
+op_execute:
+    POP(a);
+    PUSHR(ip - code);
+    ip = code + a - 1;
+    NEXT;
+op_cfunc:
+    a = *++ip;
+    SLOW(VM_CFUNC(vm, a));
+    NEXT;
+op_d2r:
+    POP(a);
+    PUSHR(a);
+    NEXT;
+op_r2d:
+    a = *rp--;
+    PUSH(a);
+    NEXT;
+op_rat:
+    PUSH(rp[0]);
+    NEXT;
+op_i:
+    PUSH(rp[0]);
+    NEXT;
+op_ii:
+    PUSH(rp[-1]);
+    NEXT;
+op_j:
+    PUSH(rp[-2]);
+    NEXT;
+op_do:
+    a = *++ip;
+    if (rp[0] >= rp[-1])
+        ip = code + a - 1;
+    NEXT;
+op_loop:
+    a = *++ip;
+    if (++rp[0] < rp[-1])
+        ip = code + a - 1;
+    NEXT;
+op_plusloop:
+    POP(b);
+    a = *++ip;
+    rp[0] += b;
+    if (rp[0] < rp[-1])
+        ip = code + a - 1;
+    NEXT;
+op_unloop:
+    rp -= 2;
+    NEXT;
+op_cells:
+    UNOP(a * sizeof(data));
+    NEXT;
+op_chars:
+    UNOP(a * sizeof(char));
+    NEXT;
+op_at:
+    UNOP(*(data *)VM_PTR(vm, a));
+    NEXT;
+op_bang:
+    *(data *)VM_PTR(vm, TOS) = S(1);
+    DROPN(2);
+    NEXT;
+op_here:
+    PUSH(VM_ADDR(vm, vm->heaptop));
+    NEXT;
+op_assert:
+    POP(a);
+    if (!a) {
+        SAVE();
+        vm_halt(vm, -2);
+    }
+    NEXT;
+op_nop:
+    NEXT;
+op_dot:
+    SLOW(op_dot);
+    NEXT;
+op_create:
+    SLOW(op_create);
+    NEXT;
+op_bye:
+    SLOW(op_bye);
+    NEXT;
+op_allot:
+    SLOW(op_allot);
+    NEXT;
+op_allocate:
+    SLOW(op_allocate);
+    NEXT;
+op_resize:
+    SLOW(op_resize);
+    NEXT;
+op_free:
+    SLOW(op_free);
+    NEXT;
+op_comma:
+    SLOW(op_comma);
+    NEXT;
+op_cr:
+    SLOW(op_cr);
+    NEXT;
+op_print:
+    SLOW(op_print);
+    NEXT;
+op_emit:
+    SLOW(op_emit);
+    NEXT;
+op_dump:
+    SLOW(op_dump);
+    NEXT;
+op_rdump:
+    SLOW(op_rdump);
+    NEXT;
+op_quote:
+    SLOW(op_quote);
+    NEXT;
+op_defer:
+    SLOW(op_defer);
+    NEXT;
+op_is:
+    SLOW(op_is);
+    NEXT;
+op_heapsize:
+    SLOW(op_heapsize);
+    NEXT;
+op_fusions:
+    SLOW(op_fusions);
+    NEXT;
+op_codesize:
+    SLOW(op_codesize);
+    NEXT;
+op_stackeffect:
+    SLOW(op_stackeffect);
+    NEXT;
+op_tiers:
+    SLOW(op_tiers);
+    NEXT;
+op_relayout:
+    SLOW(op_relayout);
+    NEXT;
+op_memos:
+    SLOW(op_memos);
+    NEXT;
+op_addi:
+    a = *++ip;
+    TOUCH();
+    TOS += a;
+    NEXT;
+op_2dup:
+    a = S(1);
+    b = TOS;
+    PUSH(a);
+    PUSH(b);
+    NEXT;
+op_jnz:
+    POP(a);
+    JUMPUNLESS(a == 0);
+    NEXT;
+op_dupjz:
+    TOUCH();
+    JUMPUNLESS(TOS != 0);
+    NEXT;
+op_dupjnz:
+    TOUCH();
+    JUMPUNLESS(TOS == 0);
+    NEXT;
+op_eqjz:
+    CMPJZ(a == b);
+    NEXT;
+op_neqjz:
+    CMPJZ(a != b);
+    NEXT;
+op_ltjz:
+    CMPJZ(a < b);
+    NEXT;
+op_gtjz:
+    CMPJZ(a > b);
+    NEXT;
+op_lejz:
+    CMPJZ(a <= b);
+    NEXT;
+op_gejz:
+    CMPJZ(a >= b);
+    NEXT;
+op_eqijz:
+    CMPIJZ(a == b);
+    NEXT;
+op_neqijz:
+    CMPIJZ(a != b);
+    NEXT;
+op_ltijz:
+    CMPIJZ(a < b);
+    NEXT;
+op_gtijz:
+    CMPIJZ(a > b);
+    NEXT;
+op_leijz:
+    CMPIJZ(a <= b);
+    NEXT;
+op_geijz:
+    CMPIJZ(a >= b);
+    NEXT;
+op_shli:
+    b = *++ip;
+    UNOP((uintptr_t)a << b);
+    NEXT;
+op_shri:
+    b = *++ip;
+    UNOP((a + (a < 0 ? ((data)1 << b) - 1 : 0)) >> b);
+    NEXT;
+op_picki:
+    a = *++ip;
+    PUSH(PICK(a));
+    NEXT;
+op_needs:
+    a = *++ip;
+    CHECKDS(a);
+    NEXT;
+op_jtab:
+    TOUCH();
+    a = ip[1];
+    b = TOS - ip[3];
+    if (b >= 0 && b < a)
+        ip = code + ip[3 * b + 4] - 1;
+    else
+        ip += 1 + 3 * a;
+    NEXT;
+op_btab:
+    TOUCH();
+    a = ip[1];
+    b = btab_find(ip + 2, a, TOS);
+    if (b >= 0)
+        ip = code + ip[3 * b + 4] - 1;
+    else
+        ip += 1 + 3 * a;
+    NEXT;
+op_casej:
+    ip += 2;
+    NEXT;
+op_tick:
+    a = *++ip;
+    if (++vm->dicthits[a] == vm->tierhot) {
+        SAVE();
+        tier_promote(vm, a);
+        LOAD();
+    }
+    NEXT;
+op_memo:
+    a = *++ip;
+    SAVE();
+    b = memo_find(vm, a);
+    LOAD();
+    if (b)
+        ip = code + *rp--;
+    NEXT;
+op_memosave:
+    a = *++ip;
+    SAVE();
+    memo_save(vm, a);
+    LOAD();
+    NEXT;
+op_tailcall:
+    ip += 2;
+    a = *ip;
+    if (a < 0)
+        FAIL("undefined word");
+    ip = code + a - 1;
+    NEXT;
+op_native:
+    a = *++ip;
+    SAVE();
+    jit_run(vm, (void *)(intptr_t)a);
+    LOAD();
+    NEXT;
+op_compact:
+    a = *++ip;
+    SAVE();
+    compact_run(vm, (const uint8_t *)(intptr_t)a);
+    LOAD();
+    NEXT;
+
+halt:
+    // the halt cell sits right after the last emitted cell, stay on it so
+    // that code emitted later is run by the next call
+    SAVE();
+    return 0;
+}
+
+data *ENGINE_OPTAB(void)
+{
+    if (ENGINE_TABLES.optab == NULL)
+        ENGINE_EXECUTE(NULL);
+    return ENGINE_TABLES.optab;
+}
+
+data ENGINE_HALTCELL(void)
+{
+    if (ENGINE_TABLES.optab == NULL)
+        ENGINE_EXECUTE(NULL);
+    return ENGINE_TABLES.haltcell;
+}
@@ -0,0 +1,95 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "tier.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "compact.h"
+#include "effect.h"
+#include "insn.h"
+#include "jit.h"
+#include "peephole.h"
+#include "vm.h"
+
+void tier_compile(struct forthvm *vm, data entry)
+{
+    if (vm->opts &
+        (OPT_PEEPHOLE | OPT_TAILCALL | OPT_FOLD | OPT_UNROLL | OPT_CASETAB))
+        peephole(vm, vm->dict[entry]);
+    effect_infer(vm, entry);
+    if (!(vm->opts & OPT_JIT) || jit_compile(vm, entry) < 0) {
+        if (vm->opts & OPT_COMPACT)
+            compact_compile(vm, entry);
+    }
+    vm->dicttier[entry] = TIER_OPT;
+    vm->dictend[entry] = vm->codesz;
+}
+
+void tier_forward(struct forthvm *vm, data from, data to)
+{
+    if (vm->code[from] != vm->optab[OP_TICK])
+        return;
+    vm->code[from] = vm->optab[OP_JMP];
+    vm->code[from + 1] = to;
+}
+
+void tier_promote(struct forthvm *vm, data entry)
+{
+    data start = vm->dict[entry];
+    struct insnlist l;
+    insn_init(&l);
+    if (vm->dicttier[entry] != TIER_BASE || start < 0 ||
+        insn_decode(vm, &l, start, vm->dictend[entry]) < 0) {
+        insn_free(&l);
+        return;
+    }
+    for (int i = 0; i < l.size; i++) {
+        if (l.buf[i].op == OP_TICK)
+            l.buf[i].dead = true;
+    }
+    data over = vm_skip_begin(vm);
+    vm_define(vm, entry, vm->codesz);
+    insn_encode(vm, &l);
+    insn_free(&l);
+    vm_mark_label(vm);
+    tier_compile(vm, entry);
+    vm_skip_end(vm, over);
+    tier_forward(vm, start, vm->dict[entry]);
+    if (vm->npromoted >= vm->promotedcap) {
+        vm->promotedcap = vm->promotedcap < 16 ? 16 : vm->promotedcap * 2;
+        vm->promoted =
+            realloc(vm->promoted, sizeof(data) * vm->promotedcap);
+    }
+    vm->promoted[vm->npromoted++] = entry;
+}
+
+// the colon words by tier with their counts, and the promotions in order
+void tier_report(struct forthvm *vm)
+{
+    char **names = vm_word_names(vm);
+    for (data i = 0; i < vm->dictsz; i++) {
+        if (vm->dicttier[i] == TIER_NONE || names[i] == NULL)
+            continue;
+        fprintf(vm->out, "%-12s tier %ld %ld\n", names[i],
+                (long)vm->dicttier[i], (long)vm->dicthits[i]);
+    }
+    for (data i = 0; i < vm->npromoted; i++)
+        fprintf(vm->out, "promoted     %s\n", names[vm->promoted[i]]);
+    free(names);
+}
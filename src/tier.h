@@ -0,0 +1,44 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef REINFORTH_TIER_H_
+#define REINFORTH_TIER_H_
+
+#include "types.h"
+
+struct forthvm;
+
+// Under OPT_TIER a colon definition is left as it was emitted, tier 0, with
+// tick instructions counting its calls and loop trips. When they reach
+// vm->tierhot it is copied without them and optimized, tier 1, which is
+// where every other definition starts.
+enum tier {
+    TIER_NONE = -1,
+    TIER_BASE,
+    TIER_OPT,
+};
+
+// run the optimizations enabled on the word ending at codesz
+void tier_compile(struct forthvm *vm, data entry);
+// recompile a tier 0 word at the end of code, code may be running
+void tier_promote(struct forthvm *vm, data entry);
+// send execution tokens of the tier 0 copy at from on to to, its entry
+// count becomes a jump
+void tier_forward(struct forthvm *vm, data from, data to);
+void tier_report(struct forthvm *vm);
+
+#endif
@@ -18,64 +18,106 @@
 #include "token.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "keyword.h"
 #include "str.h"
-#include "syntax.h"
 #include "vm.h"
 
-char peek_char(struct forthvm *vm)
+// Tokens are read in place from vm->src. Scanning stops at the end of what
+// was read so far to refill, which keeps the token from srcmark on, and a
+// word is left in vm->curword as a pointer into src and a length.
+
+// the character k past srcpos, EOF past the end of the input
+static int peek(struct forthvm *vm, size_t k)
 {
-    int c = vm_getc(vm);
-    vm_ungetc(vm, c);
+    while (vm->srcpos + k >= vm->srclen) {
+        if (vm_refill(vm) == 0)
+            return EOF;
+    }
+    return (unsigned char)vm->src[vm->srcpos + k];
+}
+
+static int next(struct forthvm *vm)
+{
+    vm->srcmark = vm->srcpos;
+    int c = peek(vm, 0);
+    if (c == EOF)
+        return EOF;
+    vm->srcpos++;
+    if (c == '\n')
+        vm->linenum++;
     return c;
 }
 
-void skipspace(struct forthvm *vm)
+static void skipspace(struct forthvm *vm)
 {
-    char c = peek_char(vm);
-    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
-        vm_getc(vm);
-        c = peek_char(vm);
-    }
+    do {
+        while (vm->srcpos < vm->srclen) {
+            char c = vm->src[vm->srcpos];
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+                goto done;
+            if (c == '\n')
+                vm->linenum++;
+            vm->srcpos++;
+        }
+        vm->srcmark = vm->srcpos;
+    } while (vm_refill(vm) > 0);
+done:
+    vm->srcmark = vm->srcpos;
 }
 
-void skipcomment(struct forthvm *vm)
+// up to and including the closing parenthesis
+static void skipcomment(struct forthvm *vm)
 {
-    char c = peek_char(vm);
-    while (c != ')') {
-        vm_getc(vm);
-        c = peek_char(vm);
-    }
-    vm_getc(vm);
+    do {
+        while (vm->srcpos < vm->srclen) {
+            char c = vm->src[vm->srcpos++];
+            if (c == ')')
+                return;
+            if (c == '\n')
+                vm->linenum++;
+        }
+        vm->srcmark = vm->srcpos;
+    } while (vm_refill(vm) > 0);
 }
 
-void parse_word(struct forthvm *vm)
+static void parse_word(struct forthvm *vm)
 {
-    int len = 0;
-    char c = peek_char(vm);
-    while (!isspace(c) && c != EOF && c != '(') {
-        if (len < 1023) {
-            vm->curword[len] = c;
-            len++;
+    do {
+        while (vm->srcpos < vm->srclen) {
+            char c = vm->src[vm->srcpos];
+            if (isspace((unsigned char)c) || c == '(')
+                goto done;
+            vm->srcpos++;
         }
-        vm_getc(vm);
-        c = peek_char(vm);
-    }
-    vm->curword[len] = '\0';
+    } while (vm_refill(vm) > 0);
+done:
+    vm->curword = vm->src + vm->srcmark;
+    vm->curlen = vm->srcpos - vm->srcmark;
 }
 
-data parse_number(struct forthvm *vm)
+// as strtol would read the word, digits after an optional minus sign
+static data parse_number(struct forthvm *vm)
 {
     parse_word(vm);
-    char *endp;
-    long num = strtol(vm->curword, &endp, 10);
-    return num;
+    const char *p = vm->curword;
+    const char *end = p + vm->curlen;
+    bool neg = p < end && *p == '-';
+    unsigned long max = neg ? (unsigned long)LONG_MAX + 1 : LONG_MAX;
+    unsigned long num = 0;
+    for (p += neg; p < end && *p >= '0' && *p <= '9'; p++) {
+        unsigned d = *p - '0';
+        num = num > (max - d) / 10 ? max : num * 10 + d;
+    }
+    return neg ? (long)-num : (long)num;
 }
 
 static void escape(struct forthvm *vm, StrBuilder *sb)
 {
-    char c = vm_getc(vm);
+    int c = next(vm);
     switch (c) {
     case 't':
         sb_appendc(sb, '\t');
@@ -95,10 +137,10 @@ static void escape(struct forthvm *vm, StrBuilder *sb)
     }
 }
 
-char *parse_string(struct forthvm *vm)
+static char *parse_string(struct forthvm *vm)
 {
-    vm_getc(vm);
-    char c = vm_getc(vm);
+    next(vm);
+    int c = next(vm);
     StrBuilder sb;
     sb_init(&sb);
     while (1) {
@@ -114,19 +156,34 @@ char *parse_string(struct forthvm *vm)
         default:
             sb_appendc(&sb, c);
         }
-        c = vm_getc(vm);
+        c = next(vm);
     }
 }
 
+// a string is pushed as its address, it is copied to the heap when its
+// pointer doesn't fit in a cell
+static data string_cell(struct forthvm *vm, char *s)
+{
+#if CELL_BITS == 32
+    size_t len = strlen(s) + 1;
+    size_t size = (len + sizeof(data) - 1) / sizeof(data) * sizeof(data);
+    vm_heap_grow(vm, size);
+    char *p = (char *)vm->heaptop - size;
+    memcpy(p, s, len);
+    free(s);
+    return VM_ADDR(vm, p);
+#else
+    return (data)s;
+#endif
+}
+
 struct token get_token(struct forthvm *vm)
 {
     struct token tok = {TOK_INVALID, 0};
     while (1) {
         skipspace(vm);
-        char c = vm_getc(vm);
-        char c1 = vm_getc(vm);
-        vm_ungetc(vm, c1);
-        vm_ungetc(vm, c);
+        int c = peek(vm, 0);
+        int c1 = peek(vm, 1);
         if (c >= '0' && c <= '9' || c == '-' && !isspace(c1)) {
             tok.type = TOK_NUM;
             tok.dat = parse_number(vm);
@@ -141,16 +198,20 @@ struct token get_token(struct forthvm *vm)
             if (s == NULL)
                 continue;
             tok.type = TOK_NUM;
-            tok.dat = (data)s;
+            tok.dat = string_cell(vm, s);
             return tok;
         } else {
             parse_word(vm);
-            int syn_num = get_syntax(vm->curword);
-            if (syn_num >= 0) {
+            vm->curhash = word_hash(vm->curword, vm->curlen);
+            const struct keyword *k =
+                keyword_find(vm->curword, vm->curlen, vm->curhash);
+            if (k != NULL && k->kind == KEY_SYNTAX) {
                 tok.type = TOK_SYNTAX;
-                tok.dat = syn_num;
+                tok.dat = k->value;
             } else {
+                // the entry of a builtin is its opcode
                 tok.type = TOK_WORD;
+                tok.dat = k != NULL ? k->value : -1;
             }
             return tok;
         }
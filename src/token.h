@@ -30,6 +30,8 @@ enum token_type {
     TOK_INVALID,
 };
 
+// dat is the number, the enum syntax, or for a word the entry of a builtin
+// and -1 for the others
 struct token {
     enum token_type type;
     data dat;
@@ -22,7 +22,20 @@
 
 struct forthvm;
 
+// bits in a cell, set with CELL_BITS=32 make. Narrow cells halve stacks,
+// code and heap but can't hold pointers: code cells are then opcodes and
+// addresses offsets into the heap, see VM_PTR.
+#ifndef CELL_BITS
+#define CELL_BITS 64
+#endif
+
+#if CELL_BITS == 32
+typedef int32_t data;
+#elif CELL_BITS == 64
 typedef intptr_t data;
+#else
+#error "CELL_BITS must be 32 or 64"
+#endif
 
 struct dbldata {
     data d1;
@@ -0,0 +1,317 @@
+/* Copyright (c) 2023, ~dzshy <dzshy@outlook.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "unroll.h"
+
+#include <stdlib.h>
+
+#include "insn.h"
+#include "opcode.h"
+
+// bounds past this are left alone rather than risk overflowing the count
+#define UNROLL_BOUND ((data)1 << (CELL_BITS * 5 / 8))
+
+// A loop compiles to
+//
+//     push limit  push start  swap  >r  >r  do end
+//   body:
+//     ...
+//   cont:
+//     loop body         or      push step  +loop body
+//   end:
+//     unloop
+//
+// where fold may already have turned the pushes and the swap into the two
+// pushes in the other order.
+struct loop {
+    int first;
+    int body;
+    int cont;
+    int back;
+    int end;
+    data start;
+    data limit;
+    data step;
+    data trips;
+};
+
+static int prev_live(struct insnlist *l, int i)
+{
+    do
+        i--;
+    while (i >= 0 && l->buf[i].dead);
+    return i;
+}
+
+static bool is_push(struct insnlist *l, int i)
+{
+    return i >= 0 && l->buf[i].op == OP_PUSH;
+}
+
+static bool in_range(data x) { return x > -UNROLL_BOUND && x < UNROLL_BOUND; }
+
+// instructions that may not be copied, they address the return stack
+// relative to the loop frame or leave the loop some other way
+static bool stays(enum opcode op)
+{
+    switch (op) {
+    case OP_D2R:
+    case OP_R2D:
+    case OP_RAT:
+    case OP_RPICK:
+    case OP_DO:
+    case OP_LOOP:
+    case OP_PLUSLOOP:
+    case OP_UNLOOP:
+    case OP_EXIT:
+    case OP_TAILCALL:
+    case OP_RDUMP:
+    case OP_NATIVE:
+    case OP_COMPACT:
+    case OP_NEEDS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool match(struct insnlist *l, bool *label, int d, struct loop *lp)
+{
+    int p = prev_live(l, d);
+    if (p < 0 || l->buf[p].op != OP_D2R || label[p] || label[d])
+        return false;
+    p = prev_live(l, p);
+    if (p < 0 || l->buf[p].op != OP_D2R || label[p])
+        return false;
+    p = prev_live(l, p);
+    if (p >= 0 && l->buf[p].op == OP_SWAP) {
+        int s = prev_live(l, p);
+        int n = prev_live(l, s);
+        if (label[p] || !is_push(l, s) || label[s] || !is_push(l, n))
+            return false;
+        lp->start = l->buf[s].arg[0];
+        lp->limit = l->buf[n].arg[0];
+        lp->first = n;
+    } else {
+        int s = prev_live(l, p);
+        if (!is_push(l, p) || !is_push(l, s) || label[p])
+            return false;
+        lp->start = l->buf[s].arg[0];
+        lp->limit = l->buf[p].arg[0];
+        lp->first = s;
+    }
+    lp->body = d + 1;
+    lp->end = l->buf[d].arg[0];
+    if (lp->end >= l->size || l->buf[lp->end].op != OP_UNLOOP)
+        return false;
+    int back = prev_live(l, lp->end);
+    if (back < lp->body || insn_target(&l->buf[back]) == NULL ||
+        *insn_target(&l->buf[back]) != lp->body)
+        return false;
+    lp->back = back;
+    if (l->buf[back].op == OP_LOOP) {
+        lp->step = 1;
+        lp->cont = back;
+    } else if (l->buf[back].op == OP_PLUSLOOP) {
+        int k = prev_live(l, back);
+        if (k < lp->body || !is_push(l, k) || label[back])
+            return false;
+        lp->step = l->buf[k].arg[0];
+        lp->cont = k;
+    } else {
+        return false;
+    }
+    if (!in_range(lp->start) || !in_range(lp->limit) || lp->step <= 0 ||
+        lp->step >= UNROLL_BOUND)
+        return false;
+    if (lp->start >= lp->limit)
+        lp->trips = 0;
+    else
+        lp->trips = (lp->limit - lp->start + lp->step - 1) / lp->step;
+    return true;
+}
+
+// the body may only be entered from the top and left through cont or end
+static bool closed(struct insnlist *l, struct loop *lp)
+{
+    for (int i = 0; i < l->size; i++) {
+        struct insn *in = &l->buf[i];
+        data *t = insn_target(in);
+        if (in->dead)
+            continue;
+        bool inside = i >= lp->body && i < lp->cont;
+        if (inside && stays(in->op))
+            return false;
+        if (t == NULL)
+            continue;
+        if (inside && (*t < lp->body || *t > lp->cont) && *t != lp->end)
+            return false;
+        if (!inside && i != lp->back && i != lp->body - 1 &&
+            *t > lp->first && *t <= lp->end)
+            return false;
+    }
+    return true;
+}
+
+// live instructions in the body and the cells they take
+static void measure(struct insnlist *l, struct loop *lp, int *n, data *cells)
+{
+    *n = 0;
+    *cells = 0;
+    for (int i = lp->body; i < lp->cont; i++) {
+        if (l->buf[i].dead)
+            continue;
+        enum opcode op = l->buf[i].op;
+        *cells += 1 + get_opargs(op) + (op == OP_I || op == OP_II);
+        (*n)++;
+    }
+}
+
+// copy number m of the body to the end of nl, i becoming start + m * step
+// or, with the frame kept, an offset from the index. rel[] is the position
+// of each body instruction in the copy, jumps to cont go to next and those
+// to end to end.
+static void copy_body(struct insnlist *nl, struct insnlist *l, struct loop *lp,
+                      int *rel, data m, bool full, int next, int end)
+{
+    int at = nl->size;
+    for (int i = lp->body; i < lp->cont; i++) {
+        struct insn in = l->buf[i];
+        if (in.dead)
+            continue;
+        data *t = insn_target(&in);
+        if (t != NULL) {
+            if (*t == lp->cont)
+                *t = next;
+            else if (*t == lp->end)
+                *t = end;
+            else
+                *t = at + rel[*t - lp->body];
+        }
+        if (full && in.op == OP_I) {
+            in = (struct insn){OP_PUSH, {lp->start + m * lp->step}};
+        } else if (full && in.op == OP_II) {
+            in = (struct insn){OP_PUSH, {lp->limit}};
+        } else if (full && in.op == OP_J) {
+            in.op = OP_I;
+        } else if (!full && in.op == OP_I && m > 0) {
+            *insn_append(nl, OP_I) = in;
+            in = (struct insn){OP_ADDI, {m * lp->step}};
+        }
+        *insn_append(nl, in.op) = in;
+    }
+}
+
+// rebuild l with the body of lp copied u times, the whole loop replaced by
+// the copies when full and the frame kept with a longer step otherwise
+static void rewrite(struct insnlist *l, struct loop *lp, data u, bool full)
+{
+    struct insnlist nl;
+    insn_init(&nl);
+    int len = lp->cont - lp->body;
+    int *map = malloc(sizeof(int) * (l->size + 1));
+    // positions in the first copy and, when partial, in the later ones
+    // where each i is followed by an addi
+    int *rel = malloc(sizeof(int) * len);
+    int *relx = malloc(sizeof(int) * len);
+    int n = 0, nx = 0;
+    for (int i = 0; i < len; i++) {
+        rel[i] = n;
+        relx[i] = nx;
+        if (!l->buf[lp->body + i].dead) {
+            n++;
+            nx += l->buf[lp->body + i].op == OP_I && !full ? 2 : 1;
+        }
+    }
+    int from = full ? lp->first : lp->body;
+    int to = full ? lp->end + 1 : lp->end;
+    for (int i = 0; i < from; i++) {
+        map[i] = nl.size;
+        *insn_append(&nl, l->buf[i].op) = l->buf[i];
+    }
+    int at = nl.size;
+    int size = full ? n * u : n + nx * (u - 1);
+    int end = full ? at + size : at + size + 2;
+    for (int i = from; i < to; i++)
+        map[i] = full ? at : end - 2;
+    for (data m = 0; m < u; m++) {
+        int next = nl.size + (m > 0 ? nx : n);
+        copy_body(&nl, l, lp, m > 0 ? relx : rel, m, full, next, end);
+    }
+    if (!full) {
+        *insn_append(&nl, OP_PUSH) = (struct insn){OP_PUSH, {u * lp->step}};
+        *insn_append(&nl, OP_PLUSLOOP) =
+            (struct insn){OP_PLUSLOOP, {lp->body}};
+        map[lp->body] = at;
+    }
+    for (int i = to; i < l->size; i++) {
+        map[i] = nl.size;
+        *insn_append(&nl, l->buf[i].op) = l->buf[i];
+    }
+    map[l->size] = nl.size;
+    // the copies already have their targets in nl, the rest point into l
+    for (int i = 0; i < nl.size; i++) {
+        data *t = insn_target(&nl.buf[i]);
+        if (t != NULL && (i < at || i >= at + size))
+            *t = map[*t];
+    }
+    free(relx);
+    free(rel);
+    free(map);
+    insn_free(l);
+    *l = nl;
+}
+
+bool unroll_loops(struct insnlist *l, data limit)
+{
+    bool *label = calloc(l->size + 1, sizeof(bool));
+    for (int i = 0; i < l->size; i++) {
+        data *t = insn_target(&l->buf[i]);
+        if (!l->buf[i].dead && t != NULL)
+            label[*t] = true;
+    }
+    bool changed = false;
+    for (int i = 0; i < l->size && !changed; i++) {
+        struct loop lp;
+        if (l->buf[i].dead || l->buf[i].op != OP_DO)
+            continue;
+        if (!match(l, label, i, &lp) || !closed(l, &lp))
+            continue;
+        int n;
+        data cells;
+        measure(l, &lp, &n, &cells);
+        if (n == 0)
+            cells = 1;
+        if (lp.trips * cells <= limit) {
+            rewrite(l, &lp, lp.trips, true);
+            changed = true;
+            continue;
+        }
+        // a whole number of copies per trip keeps the limit check exact
+        data u = limit / cells;
+        if (u > lp.trips / 2)
+            u = lp.trips / 2;
+        while (u >= 2 && lp.trips % u != 0)
+            u--;
+        if (u >= 2) {
+            rewrite(l, &lp, u, false);
+            changed = true;
+        }
+    }
+    free(label);
+    return changed;
+}
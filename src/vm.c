@@ -17,31 +17,59 @@
 
 #include "vm.h"
 
+#include <signal.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "crc32.h"
+#include "inline.h"
+#include "jit.h"
+#include "keyword.h"
+#include "threaded.h"
+#include "tier.h"
 #include "token.h"
 
+// words looked up are not terminated, they are read in place
 struct word_entry {
-    char *word;
+    const char *word;
+    int len;
+    // word_hash of word, computed once by the lexer
+    uint32_t hash;
     data entry;
 };
 
 uint32_t word_entry_hash(void *p)
 {
     struct word_entry *kv = p;
-    int size = strlen(kv->word);
-    return crc32(0, kv->word, size);
+    return kv->hash;
 }
 
 bool word_entry_eq(void *a_, void *b_)
 {
     struct word_entry *a = a_;
     struct word_entry *b = b_;
-    if (strcmp(a->word, b->word) == 0) {
-        return true;
-    }
-    return false;
+    return a->hash == b->hash && a->len == b->len &&
+           memcmp(a->word, b->word, a->len) == 0;
+}
+
+struct opcell_entry {
+    data cell;
+    enum opcode op;
+};
+
+uint32_t opcell_entry_hash(void *p)
+{
+    struct opcell_entry *e = p;
+    return crc32(0, &e->cell, sizeof(data));
+}
+
+bool opcell_entry_eq(void *a_, void *b_)
+{
+    struct opcell_entry *a = a_;
+    struct opcell_entry *b = b_;
+    return a->cell == b->cell;
 }
 
 static void *make_space(void *buf, data *cap, data idx)
@@ -54,108 +82,443 @@ static void *make_space(void *buf, data *cap, data idx)
     return buf;
 }
 
-static data create_word(struct forthvm *vm, char *word)
+static data create_word(struct forthvm *vm, const char *word, int len,
+                        uint32_t hash)
 {
-    char *dup_word = strdup(word);
+    char *dup_word = strndup(word, len);
+    data flagscap = vm->dictcap;
+    data incap = vm->dictcap;
+    data outcap = vm->dictcap;
+    data linkcap = vm->dictcap;
+    data hitscap = vm->dictcap;
+    data tiercap = vm->dictcap;
+    data endcap = vm->dictcap;
+    data inlinecap = vm->dictcap;
+    data formcap = vm->dictcap;
+    data cellscap = vm->dictcap;
     vm->dict = make_space(vm->dict, &vm->dictcap, vm->dictsz);
+    vm->dictflags = make_space(vm->dictflags, &flagscap, vm->dictsz);
+    vm->dictin = make_space(vm->dictin, &incap, vm->dictsz);
+    vm->dictout = make_space(vm->dictout, &outcap, vm->dictsz);
+    vm->dictlink = make_space(vm->dictlink, &linkcap, vm->dictsz);
+    vm->dicthits = make_space(vm->dicthits, &hitscap, vm->dictsz);
+    vm->dicttier = make_space(vm->dicttier, &tiercap, vm->dictsz);
+    vm->dictend = make_space(vm->dictend, &endcap, vm->dictsz);
+    vm->dictinline = make_space(vm->dictinline, &inlinecap, vm->dictsz);
+    vm->dictform = make_space(vm->dictform, &formcap, vm->dictsz);
+    vm->dictcells = make_space(vm->dictcells, &cellscap, vm->dictsz);
     vm->dict[vm->dictsz] = -1;
-    struct word_entry we = (struct word_entry){dup_word, vm->dictsz};
+    vm->dictflags[vm->dictsz] = 0;
+    vm->dictin[vm->dictsz] = -1;
+    vm->dictout[vm->dictsz] = -1;
+    vm->dictlink[vm->dictsz] = -1;
+    vm->dicthits[vm->dictsz] = 0;
+    vm->dicttier[vm->dictsz] = TIER_NONE;
+    vm->dictend[vm->dictsz] = -1;
+    vm->dictinline[vm->dictsz] = -1;
+    vm->dictform[vm->dictsz] = -1;
+    vm->dictcells[vm->dictsz] = -1;
+    struct word_entry we = {dup_word, len, hash, vm->dictsz};
     htable_insert(vm->wordtable, &we);
     vm->dictsz++;
     return vm->dictsz - 1;
 }
 
-static data find_word(struct forthvm *vm, char *word)
+static data find_word(struct forthvm *vm, const char *word, int len,
+                      uint32_t hash)
 {
-    struct word_entry we;
-    we.word = word;
+    struct word_entry we = {word, len, hash};
     struct word_entry *iter = htable_find(vm->wordtable, &we);
     if (iter != NULL)
         return iter->entry;
-    return create_word(vm, word);
+    return create_word(vm, word, len, hash);
+}
+
+static data find_name(struct forthvm *vm, const char *name)
+{
+    int len = strlen(name);
+    return find_word(vm, name, len, word_hash(name, len));
+}
+
+// the entry of the word just read, builtins were found by the lexer
+static data token_entry(struct forthvm *vm, struct token tok)
+{
+    if (tok.dat >= 0)
+        return tok.dat;
+    return find_word(vm, vm->curword, vm->curlen, vm->curhash);
+}
+
+// the name of each entry, to be freed by the caller but not its strings
+char **vm_word_names(struct forthvm *vm)
+{
+    char **names = calloc(vm->dictsz + 1, sizeof(char *));
+    for (struct word_entry *we = htable_begin(vm->wordtable); we != NULL;
+         we = htable_next(vm->wordtable, we))
+        names[we->entry] = (char *)we->word;
+    return names;
+}
+
+// the stacks never grow and are never checked, they sit between two
+// inaccessible pages and running off either end faults into trap_fault
+data vm_pop_ds(struct forthvm *vm) { return vm->ds[vm->dsp--]; }
+
+void vm_push_ds(struct forthvm *vm, data d) { vm->ds[++vm->dsp] = d; }
+
+data vm_pop_rs(struct forthvm *vm) { return vm->rs[vm->rsp--]; }
+
+void vm_push_rs(struct forthvm *vm, data d) { vm->rs[++vm->rsp] = d; }
+
+void vm_emit_data(struct forthvm *vm, data d)
+{
+    vm->code = make_space(vm->code, &vm->codecap, vm->codesz + 1);
+    vm->code[vm->codesz] = d;
+    vm->codesz++;
+    vm->code[vm->codesz] = vm->haltcell;
+}
+
+void vm_emit_opcode(struct forthvm *vm, enum opcode op)
+{
+    if (fuse_opcode(vm, op))
+        return;
+    fuse_record(vm, vm->codesz, op);
+    vm_emit_data(vm, vm->optab[op]);
+}
+
+// Calls carry the entry of the word they call and its address, which saves
+// looking the word up on each call. Every address cell is chained to the
+// word so that giving it new code patches them, code rewritten since may
+// have left stale sites, which are dropped when found.
+static void add_site(struct forthvm *vm, data entry, data pos)
+{
+    data i = vm->freesite;
+    if (i >= 0) {
+        vm->freesite = vm->sites[i].next;
+    } else {
+        if (vm->nsites >= vm->sitecap) {
+            vm->sitecap = vm->sitecap < 64 ? 64 : vm->sitecap * 2;
+            vm->sites =
+                realloc(vm->sites, sizeof(struct callsite) * vm->sitecap);
+        }
+        i = vm->nsites++;
+    }
+    vm->sites[i] = (struct callsite){pos, vm->dictlink[entry]};
+    vm->dictlink[entry] = i;
+}
+
+static bool is_site(struct forthvm *vm, data entry, data pos)
+{
+    if (pos + 1 > vm->codesz)
+        return false;
+    data op = vm->code[pos - 2];
+    return vm->code[pos - 1] == entry &&
+           (op == vm->optab[OP_CALL] || op == vm->optab[OP_TAILCALL]);
+}
+
+// op is OP_CALL or OP_TAILCALL, a word not defined yet is linked when it is
+void vm_emit_call(struct forthvm *vm, enum opcode op, data entry)
+{
+    vm_emit_opcode(vm, op);
+    vm_emit_data(vm, entry);
+    add_site(vm, entry, vm->codesz);
+    vm_emit_data(vm, vm->dict[entry]);
+}
+
+// give a word new code, the calls linked to it follow
+void vm_define(struct forthvm *vm, data entry, data addr)
+{
+    vm->dict[entry] = addr;
+    // defer sets it again after
+    vm->dictflags[entry] &= ~WORD_DEFER;
+    data *prev = &vm->dictlink[entry];
+    while (*prev >= 0) {
+        data i = *prev;
+        struct callsite *s = &vm->sites[i];
+        if (is_site(vm, entry, s->pos)) {
+            vm->code[s->pos] = addr;
+            prev = &s->next;
+            continue;
+        }
+        *prev = s->next;
+        s->next = vm->freesite;
+        vm->freesite = i;
+    }
+}
+
+// the current end of code is a branch target or has been executed,
+// instructions before it must not be rewritten any more
+void vm_mark_label(struct forthvm *vm) { fuse_reset(vm); }
+
+// Code emitted between these two is jumped over by the code running when
+// they are called, which ends at the halt cell that was the end of code.
+data vm_skip_begin(struct forthvm *vm)
+{
+    vm_mark_label(vm);
+    vm_emit_opcode(vm, OP_JMP);
+    data over = vm->codesz;
+    vm_emit_data(vm, -1);
+    vm_mark_label(vm);
+    return over;
+}
+
+void vm_skip_end(struct forthvm *vm, data over)
+{
+    vm->code[over] = vm->codesz;
+    vm_mark_label(vm);
+}
+
+// call while compiling, the cell cannot be emitted under running code
+void vm_reserve_halt(struct forthvm *vm)
+{
+    if (vm->haltpos >= 0)
+        return;
+    vm->haltpos = vm->codesz;
+    vm_emit_data(vm, vm->haltcell);
+    vm_mark_label(vm);
+}
+
+void vm_call(struct forthvm *vm, data entry)
+{
+    data addr = vm->dict[entry];
+    if (addr < 0)
+        vm_error(vm, "undefined word");
+    vm_call_at(vm, addr);
+}
+
+void vm_call_at(struct forthvm *vm, data addr)
+{
+    data pc = vm->pc;
+    vm_push_rs(vm, vm->haltpos - 1);
+    vm->pc = addr;
+    vm_execute(vm);
+    vm->pc = pc;
+}
+
+int vm_set_engine(struct forthvm *vm, enum engine e)
+{
+    // code already emitted cannot be translated
+    if (vm->codesz > 0)
+        return -1;
+    switch (e) {
+    case ENGINE_CALL:
+        for (int i = 0; i < (int)OP_NOP + 1; i++) {
+            vm->optab[i] = get_opaddr((enum opcode)i);
+        }
+        vm->haltcell = 0;
+        break;
+#ifdef __GNUC__
+    case ENGINE_THREADED:
+        memcpy(vm->optab, threaded_optab(), sizeof(vm->optab));
+        vm->haltcell = threaded_haltcell();
+        break;
+    case ENGINE_TOS:
+        memcpy(vm->optab, tos_optab(), sizeof(vm->optab));
+        vm->haltcell = tos_haltcell();
+        break;
+#endif
+    default:
+        return -1;
+    }
+#if CELL_BITS == 32
+    // handler addresses don't fit in a cell, every engine runs opcodes
+    for (int i = 0; i < (int)OP_NOP + 1; i++)
+        vm->optab[i] = i;
+    vm->haltcell = OP_NOP + 1;
+#endif
+    vm->engine = e;
+    vm->code[0] = vm->haltcell;
+
+    if (vm->opcells == NULL) {
+        vm->opcells = malloc(sizeof(HTable));
+    } else {
+        free(vm->opcells->buf);
+    }
+    htable_init(vm->opcells, sizeof(struct opcell_entry), OP_NOP * 4,
+                opcell_entry_hash, opcell_entry_eq);
+    for (int i = 0; i < (int)OP_NOP + 1; i++) {
+        struct opcell_entry oe = {vm->optab[i], (enum opcode)i};
+        htable_insert(vm->opcells, &oe);
+    }
+    return 0;
 }
 
-data vm_pop_ds(struct forthvm *vm)
+int vm_decode(struct forthvm *vm, data cell)
 {
-    if (vm->dsp <= 0) {
-        vm->errmsg = "pop from data stack failed";
-        vm->finished = true;
-        vm->ret = -1;
+    struct opcell_entry oe;
+    oe.cell = cell;
+    struct opcell_entry *iter = htable_find(vm->opcells, &oe);
+    if (iter == NULL)
         return -1;
+    return iter->op;
+}
+
+// the vm inside vm_run on this thread, stack faults are reported to it
+static __thread struct forthvm *trapvm;
+static size_t pagesz;
+
+// map cap cells between two inaccessible pages, cap is rounded up to whole
+// pages. Index 0 is the last cell of the lower guard page, so popping an
+// empty stack faults like any other underflow.
+static data *map_stack(data *cap)
+{
+    size_t len = (*cap * sizeof(data) + pagesz - 1) / pagesz * pagesz;
+    char *p = mmap(NULL, len + 2 * pagesz, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (mprotect(p + pagesz, len, PROT_READ | PROT_WRITE) < 0) {
+        munmap(p, len + 2 * pagesz);
+        return NULL;
     }
-    data r = vm->ds[vm->dsp];
-    vm->dsp--;
-    return r;
+    *cap = len / sizeof(data);
+    return (data *)(p + pagesz) - 1;
 }
 
-void vm_push_ds(struct forthvm *vm, data d)
+static void unmap_stack(data *s, data cap)
 {
-    vm->dsp++;
-    vm->ds = make_space(vm->ds, &vm->dscap, vm->dsp);
-    vm->ds[vm->dsp] = d;
+    if (s == NULL)
+        return;
+    munmap((char *)(s + 1) - pagesz, cap * sizeof(data) + 2 * pagesz);
 }
 
-data vm_pop_rs(struct forthvm *vm)
+// -1 if addr is in the guard page below the stack, 1 if above, else 0
+static int guard_hit(data *s, data cap, char *addr)
 {
-    if (vm->rsp <= 0) {
-        vm->errmsg = "pop from return stack failed";
-        vm->finished = true;
-        vm->ret = -1;
+    char *lo = (char *)(s + 1);
+    char *hi = (char *)(s + 1 + cap);
+    if (s == NULL)
+        return 0;
+    if (addr >= lo - pagesz && addr < lo)
         return -1;
+    if (addr >= hi && addr < hi + pagesz)
+        return 1;
+    return 0;
+}
+
+static void trap_fault(int sig, siginfo_t *si, void *ctx)
+{
+    struct forthvm *vm = trapvm;
+    int ds = 0, rs = 0;
+    if (vm != NULL) {
+        ds = guard_hit(vm->ds, vm->dscap, si->si_addr);
+        rs = guard_hit(vm->rs, vm->rscap, si->si_addr);
+    }
+    // native code recursing deeper than the return stack allows may run
+    // out of machine stack first
+    if (vm != NULL && jit_fault(vm, si->si_addr))
+        rs = 1;
+    if (ds == 0 && rs == 0) {
+        // not a stack fault, let it happen again and kill us
+        signal(sig, SIG_DFL);
+        return;
     }
-    data r = vm->rs[vm->rsp];
-    vm->rsp--;
-    return r;
+    if (ds < 0)
+        vm->errmsg = "no enough element on data stack";
+    else if (ds > 0)
+        vm->errmsg = "data stack overflow";
+    else if (rs < 0)
+        vm->errmsg = "no enough element on return stack";
+    else
+        vm->errmsg = "return stack overflow";
+    vm->finished = true;
+    vm->ret = -1;
+    siglongjmp(*vm->trap, 1);
 }
 
-void vm_push_rs(struct forthvm *vm, data d)
+// errors are rare, so handlers do not check for them on the way back from
+// a callee. Whatever stops the vm unwinds straight to vm_run instead, only
+// valid while it runs.
+void vm_halt(struct forthvm *vm, int ret)
 {
-    vm->rsp++;
-    vm->rs = make_space(vm->rs, &vm->rscap, vm->rsp);
-    vm->rs[vm->rsp] = d;
+    vm->finished = true;
+    vm->ret = ret;
+    siglongjmp(*vm->trap, 1);
 }
 
-void vm_emit_data(struct forthvm *vm, data d)
+void vm_error(struct forthvm *vm, char *msg)
 {
-    vm->code = make_space(vm->code, &vm->codecap, vm->codesz);
-    vm->code[vm->codesz] = d;
-    vm->codesz++;
+    vm->errmsg = msg;
+    vm_halt(vm, -1);
 }
 
-void vm_emit_opcode(struct forthvm *vm, enum opcode op)
+static void trap_init(void)
+{
+    static bool done;
+    if (done)
+        return;
+    pagesz = sysconf(_SC_PAGESIZE);
+    // the handler cannot run on a machine stack that overflowed
+    stack_t ss = {0};
+    ss.ss_size = SIGSTKSZ;
+    ss.ss_sp = malloc(ss.ss_size);
+    sigaltstack(&ss, NULL);
+    struct sigaction sa = {0};
+    sa.sa_sigaction = trap_fault;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+    done = true;
+}
+
+int vm_stacksz(struct forthvm *vm, data dssz, data rssz)
 {
-    data d = get_opaddr(op);
-    vm_emit_data(vm, d);
+    unmap_stack(vm->ds, vm->dscap);
+    unmap_stack(vm->rs, vm->rscap);
+    vm->dscap = dssz;
+    vm->rscap = rssz;
+    vm->ds = map_stack(&vm->dscap);
+    vm->rs = map_stack(&vm->rscap);
+    vm->dsp = 0;
+    vm->rsp = 0;
+    if (vm->ds == NULL || vm->rs == NULL)
+        return -1;
+    return 0;
 }
 
 void vm_init(struct forthvm *vm, FILE *fin, FILE *fout)
 {
     *vm = (struct forthvm){0};
 
-    vm->ds = malloc(1024 * sizeof(data));
-    vm->rs = malloc(1024 * sizeof(data));
+    trap_init();
+    vm_stacksz(vm, DEFAULT_STACKSZ, DEFAULT_STACKSZ);
     vm->heap = malloc(4096);
     vm->dict = malloc(1024 * sizeof(data));
+    vm->dictflags = malloc(1024 * sizeof(data));
+    vm->dictin = malloc(1024 * sizeof(data));
+    vm->dictout = malloc(1024 * sizeof(data));
+    vm->dictlink = malloc(1024 * sizeof(data));
+    vm->dicthits = malloc(1024 * sizeof(data));
+    vm->dicttier = malloc(1024 * sizeof(data));
+    vm->dictend = malloc(1024 * sizeof(data));
+    vm->dictinline = malloc(1024 * sizeof(data));
+    vm->dictform = malloc(1024 * sizeof(data));
+    vm->dictcells = malloc(1024 * sizeof(data));
     vm->code = malloc(1024 * sizeof(data));
     vm->heaptop = vm->heap;
 
-    vm->dscap = 1024;
-    vm->rscap = 1024;
     vm->heapcap = 4096;
+    vm->heapend = 4096;
     vm->dictcap = 1024;
     vm->codecap = 1024;
     vm->linenum = 1;
+    vm->lastword = -1;
+    vm->haltpos = -1;
+    vm->freesite = -1;
+    vm->freeinline = -1;
 
-    vm->curword = malloc(1024);
     vm->wordtable = malloc(sizeof(HTable));
     htable_init(vm->wordtable, sizeof(struct word_entry), -1, word_entry_hash,
                 word_entry_eq);
     vm->ready = true;
     vm->errmsg = "";
+    vm->opts = OPT_DEFAULT;
+    vm->unrollmax = DEFAULT_UNROLL;
+    vm->tierhot = DEFAULT_TIERHOT;
+    vm->memosize = DEFAULT_MEMOSIZE;
+    vm_set_engine(vm, DEFAULT_ENGINE);
 
-    for (data i = 0; i < (data)OP_NOP + 1; i++) {
-        find_word(vm, get_opname((enum opcode)i));
-    }
+    // the entry of each builtin is its opcode
+    for (data i = 0; i < (data)OP_NOP + 1; i++)
+        find_name(vm, get_opname((enum opcode)i));
 
     vm->in = fin;
     vm->out = fout;
@@ -166,27 +529,33 @@ void vm_heapsz(struct forthvm *vm, data sz)
     vm->heap = realloc(vm->heap, sz);
     vm->heaptop = vm->heap;
     vm->heapcap = sz;
+    vm->heapend = sz;
 }
 
 data vm_execute(struct forthvm *vm)
 {
     if (!vm->ready)
         return 0;
-    data a, b;
-    opfunc func_ptr;
-    data ret = 0;
-    enum opcode op;
-
-    while (!vm->finished) {
-        if (vm->pc >= vm->codesz) {
-            break;
-        }
-        data op_addr = vm->code[vm->pc];
+    vm_mark_label(vm);
+#ifdef __GNUC__
+    if (vm->engine == ENGINE_THREADED)
+        return threaded_execute(vm);
+    if (vm->engine == ENGINE_TOS)
+        return tos_execute(vm);
+#endif
+    // the halt cell ends the code and the words run by vm_call, errors
+    // unwind past this loop
+    data op_addr;
+    while ((op_addr = vm->code[vm->pc]) != vm->haltcell) {
+#if CELL_BITS == 32
+        opfunc opf = get_opfunc(op_addr);
+#else
         opfunc opf = *(opfunc *)&op_addr;
+#endif
         (*opf)(vm);
         vm->pc++;
     }
-    return ret;
+    return 0;
 }
 
 static int compile(struct forthvm *vm)
@@ -202,12 +571,11 @@ static int compile(struct forthvm *vm)
             vm_emit_data(vm, tok.dat);
             break;
         case TOK_WORD:
-            entry = find_word(vm, vm->curword);
+            entry = token_entry(vm, tok);
             if (entry < (data)OP_NOP) {
                 vm_emit_opcode(vm, entry);
-            } else {
-                vm_emit_opcode(vm, OP_CALL);
-                vm_emit_data(vm, entry);
+            } else if (!inline_call(vm, entry)) {
+                vm_emit_call(vm, OP_CALL, entry);
             }
             if (vm->ready)
                 return 1;
@@ -229,63 +597,155 @@ static int compile(struct forthvm *vm)
 
 void vm_heap_grow(struct forthvm *vm, data size)
 {
-    if (vm->heaptop + size - vm->heap <= vm->heapcap) {
-        vm->heaptop += size;
-        return;
+    if (vm->heaptop + size - vm->heap > vm->heapend)
+        vm_error(vm, "failed to allot memory");
+    vm->heaptop += size;
+}
+
+#if CELL_BITS == 32
+// Blocks sit below heapend, each after a cell with its size, negated once
+// it is freed. Only freeing the lowest block gives memory back, together
+// with the freed blocks right above it.
+data vm_allocate(struct forthvm *vm, data size)
+{
+    if (size < 0)
+        vm_error(vm, "failed to allocate memory");
+    data len = (size + 2 * sizeof(data) - 1) / sizeof(data) * sizeof(data);
+    if (vm->heapend - len < VM_ADDR(vm, vm->heaptop))
+        vm_error(vm, "failed to allocate memory");
+    vm->heapend -= len;
+    *(data *)VM_PTR(vm, vm->heapend) = len;
+    return vm->heapend + sizeof(data);
+}
+
+void vm_free(struct forthvm *vm, data addr)
+{
+    data *p = VM_PTR(vm, addr - sizeof(data));
+    *p = -*p;
+    while (vm->heapend < vm->heapcap) {
+        p = VM_PTR(vm, vm->heapend);
+        if (*p > 0)
+            break;
+        vm->heapend -= *p;
     }
-    vm->finished = true;
-    vm->ret = -1;
-    vm->errmsg = "failed to allot memory";
 }
 
+data vm_resize(struct forthvm *vm, data addr, data size)
+{
+    data len = *(data *)VM_PTR(vm, addr - sizeof(data)) - sizeof(data);
+    data to = vm_allocate(vm, size);
+    memcpy(VM_PTR(vm, to), VM_PTR(vm, addr), len < size ? len : size);
+    vm_free(vm, addr);
+    return to;
+}
+
+data vm_cfunc_cell(struct forthvm *vm, opfunc f)
+{
+    for (data i = 0; i < vm->ncfuncs; i++) {
+        if (vm->cfuncs[i] == f)
+            return i;
+    }
+    if (vm->ncfuncs == vm->cfunccap) {
+        vm->cfunccap = vm->cfunccap == 0 ? 16 : vm->cfunccap * 2;
+        vm->cfuncs = realloc(vm->cfuncs, sizeof(opfunc) * vm->cfunccap);
+    }
+    vm->cfuncs[vm->ncfuncs] = f;
+    return vm->ncfuncs++;
+}
+#else
+data vm_allocate(struct forthvm *vm, data size) { return (data)malloc(size); }
+
+void vm_free(struct forthvm *vm, data addr) { free((void *)addr); }
+
+data vm_resize(struct forthvm *vm, data addr, data size)
+{
+    return (data)realloc((void *)addr, size);
+}
+
+data vm_cfunc_cell(struct forthvm *vm, opfunc f) { return *(data *)&f; }
+#endif
+
 data vm_read_word(struct forthvm *vm)
 {
     struct token tok;
     tok = get_token(vm);
-    if (tok.type != TOK_WORD) {
-        vm->finished = true;
-        vm->ret = -1;
-        vm->errmsg = "next input token is expeted to be a word";
-        return -1;
-    }
-    return find_word(vm, vm->curword);
+    if (tok.type != TOK_WORD)
+        vm_error(vm, "next input token is expeted to be a word");
+    return token_entry(vm, tok);
 }
 
-char vm_getc(struct forthvm *vm)
+// map a regular file whole, the lexer then never refills
+static bool map_source(struct forthvm *vm, int fd)
 {
-    char c = fgetc(vm->in);
-    if (c == '\n')
-        vm->linenum++;
-    return c;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return false;
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    vm->src = p;
+    vm->srclen = st.st_size;
+    vm->srcmapped = true;
+    return true;
 }
 
-void vm_ungetc(struct forthvm *vm, char c)
+// read more of vm->in after the text from srcmark on, which is moved to the
+// start of the buffer, returns the bytes read or 0 at the end of the input
+size_t vm_refill(struct forthvm *vm)
 {
-    if (c == EOF)
-        return;
-    if (c == '\n')
-        vm->linenum--;
-    ungetc(c, vm->in);
+    int fd = fileno(vm->in);
+    if (vm->src == NULL && map_source(vm, fd))
+        return vm->srclen;
+    if (vm->srcmapped)
+        return 0;
+    if (vm->srcmark > 0) {
+        memmove(vm->src, vm->src + vm->srcmark, vm->srclen - vm->srcmark);
+        vm->srclen -= vm->srcmark;
+        vm->srcpos -= vm->srcmark;
+        vm->srcmark = 0;
+    }
+    if (vm->srclen == vm->srccap) {
+        vm->srccap = vm->srccap == 0 ? 1 << 16 : vm->srccap * 2;
+        vm->src = realloc(vm->src, vm->srccap);
+    }
+    // read returns what a terminal or pipe has, fread would wait for more
+    ssize_t n = read(fd, vm->src + vm->srclen, vm->srccap - vm->srclen);
+    if (n <= 0)
+        return 0;
+    vm->srclen += n;
+    return n;
 }
 
 void vm_regfunc(struct forthvm *vm, char *word, opfunc f)
 {
-    data entry = find_word(vm, word);
-    data faddr = *(data *)&f;
+    data entry = find_name(vm, word);
+    data faddr = vm_cfunc_cell(vm, f);
     vm_emit_opcode(vm, OP_JMP);
     vm_emit_data(vm, vm->codesz + 4);
-    vm->dict[entry] = vm->codesz;
+    vm_define(vm, entry, vm->codesz);
+    vm->dictin[entry] = -1;
+    vm->dictout[entry] = -1;
     vm_emit_opcode(vm, OP_CFUNC);
     vm_emit_data(vm, faddr);
     vm_emit_opcode(vm, OP_EXIT);
+    vm_mark_label(vm);
 }
 
 void vm_run(struct forthvm *vm)
 {
-    data ret;
-    while (!vm->finished) {
-        while (!vm->finished && !compile(vm))
-            ;
-        vm_execute(vm);
+    sigjmp_buf trap;
+    struct forthvm *outer = trapvm;
+    // errors and stack faults anywhere below land back here
+    if (sigsetjmp(trap, 1) == 0) {
+        vm->trap = &trap;
+        trapvm = vm;
+        while (!vm->finished) {
+            while (!vm->finished && !compile(vm))
+                ;
+            vm_execute(vm);
+        }
     }
+    trapvm = outer;
+    vm->trap = NULL;
 }
@@ -18,32 +18,173 @@
 #ifndef REINFORTH_VM_H_
 #define REINFORTH_VM_H_
 
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "fuse.h"
 #include "htable.h"
 #include "opcode.h"
 #include "syntax.h"
 #include "types.h"
 
+struct insnlist;
+struct jit;
+struct memo;
+
+enum engine {
+    ENGINE_CALL,
+    ENGINE_THREADED,
+    ENGINE_TOS,
+};
+
+#ifndef DEFAULT_ENGINE
+#ifdef __GNUC__
+#define DEFAULT_ENGINE ENGINE_TOS
+#else
+#define DEFAULT_ENGINE ENGINE_CALL
+#endif
+#endif
+
+enum optflag {
+    OPT_FUSE = 1 << 0,
+    OPT_PEEPHOLE = 1 << 1,
+    OPT_INLINE = 1 << 2,
+    OPT_TAILCALL = 1 << 3,
+    // compile colon definitions to native code, not on by default
+    OPT_JIT = 1 << 4,
+    OPT_FOLD = 1 << 5,
+    // re-encode colon definitions in the compact format, not on by default
+    OPT_COMPACT = 1 << 6,
+    // drop the depth checks of picks the stack effect of a word proves
+    OPT_EFFECT = 1 << 7,
+    OPT_UNROLL = 1 << 8,
+    // dispatch case statements on literals through a table
+    OPT_CASETAB = 1 << 9,
+    // leave the passes above to words found hot, not on by default
+    OPT_TIER = 1 << 10,
+};
+
+#define OPT_DEFAULT                                                            \
+    (OPT_FUSE | OPT_PEEPHOLE | OPT_INLINE | OPT_TAILCALL | OPT_FOLD |         \
+     OPT_EFFECT | OPT_UNROLL | OPT_CASETAB)
+
+// cells of code OPT_UNROLL may turn a loop body into
+#define DEFAULT_UNROLL 64
+
+// calls and loop trips making a word hot under OPT_TIER
+#define DEFAULT_TIERHOT 1000
+
+// results kept for each memoized word
+#define DEFAULT_MEMOSIZE 4096
+
+// code generated by OPT_JIT, a template per instruction or a call to the
+// handler of each instruction
+enum jitmode {
+    JIT_TEMPLATE,
+    JIT_CALLS,
+};
+
+// per word flags, see vm->dictflags
+enum wordflag {
+    WORD_NOINLINE = 1 << 0,
+    // made by defer, its body is a jump patched by is
+    WORD_DEFER = 1 << 1,
+    // called through a cache of its results, see memo.h
+    WORD_MEMO = 1 << 2,
+};
+
+// the address cell of a call, chained from vm->dictlink of the word called
+struct callsite {
+    data pos;
+    data next;
+};
+
+// a word another was copied into, chained from vm->dictinline of the word
+// copied
+struct inlinesite {
+    data caller;
+    data next;
+};
+
+// the cells a copy of a word takes in the word being defined
+struct inlinecopy {
+    data entry;
+    data from;
+    data to;
+};
+
+// cells per stack, only touched pages take memory
+#define DEFAULT_STACKSZ (1 << 20)
+
+// the memory at address a and the address of p, pointers are addresses
+// when they fit in a cell and heap offsets otherwise
+#if CELL_BITS == 32
+#define VM_PTR(vm, a) ((void *)((char *)(vm)->heap + (a)))
+#define VM_ADDR(vm, p) ((data)((char *)(p) - (char *)(vm)->heap))
+#define VM_CFUNC(vm, cell) ((vm)->cfuncs[cell])
+#else
+#define VM_PTR(vm, a) ((void *)(a))
+#define VM_ADDR(vm, p) ((data)(p))
+#define VM_CFUNC(vm, cell) ((opfunc)(cell))
+#endif
+
 struct forthvm {
     data *ds;
     data *rs;
     void *heap;
     data *dict;
+    data *dictflags;
+    // stack effect of each word as in ( in -- out ), -1 if not known
+    data *dictin;
+    data *dictout;
+    // first of the calls linked to each word, an index in sites or -1
+    data *dictlink;
+    struct callsite *sites;
+    data sitecap;
+    data nsites;
+    // chain of unused sites
+    data freesite;
+    // calls and loop trips counted by tier 0 code, the tier of each word
+    // and the end of its code, see tier.h
+    data *dicthits;
+    data *dicttier;
+    data *dictend;
+    // the cells a native or compact word was compiled from, see inline_call
+    data *dictcells;
+    // first of the words each word was copied into, an index in inlines or
+    // -1, and the code of each word with calls in place of its copies, an
+    // index in forms or -1, see inline.h
+    data *dictinline;
+    data *dictform;
+    struct inlinesite *inlines;
+    data inlinecap;
+    data ninlines;
+    data freeinline;
+    struct insnlist *forms;
+    data formcap;
+    data nforms;
+    struct inlinecopy *copies;
+    data copycap;
+    data ncopies;
     data *code;
     HTable *wordtable;
+    HTable *opcells;
 
     data pc;
     data dsp;
     data rsp;
     void *heaptop;
+    // allocate takes blocks from here down when addresses are offsets
+    data heapend;
     data ret;
 
     data codesz;
     data dictsz;
+    // word being defined, or the last one defined
+    data lastword;
     data wordreposz;
 
     data dscap;
@@ -53,11 +194,66 @@ struct forthvm {
     data codecap;
     data linenum;
 
+    // code cell emitted for each opcode, and the cell kept right after the
+    // end of code, both depend on the engine
+    enum engine engine;
+    data optab[OP_NOP + 1];
+    data haltcell;
+    // a halt cell that stays, vm_call runs words from C returning on it
+    data haltpos;
+
+    // functions called by OP_CFUNC when its operand is an index in them
+    opfunc *cfuncs;
+    data ncfuncs;
+    data cfunccap;
+
+    // optimizations enabled, see enum optflag
+    int opts;
+    enum jitmode jitmode;
+    data unrollmax;
+    data tierhot;
+    // words promoted from tier 0, in order
+    data *promoted;
+    data npromoted;
+    data promotedcap;
+    struct memo *memos;
+    data nmemos;
+    data memocap;
+    data memosize;
+    // instructions emitted since the last branch target, which may still be
+    // merged into a superinstruction
+    data recentpos[FUSE_WINDOW];
+    enum opcode recentop[FUSE_WINDOW];
+    int nrecent;
+    data fusecnt[FUSE_MAXRULES];
+    // definitions in the compact format, their size as cells and compact
+    data compactwords;
+    data compactfrom;
+    data compactto;
+
+    // native code state, created by the first jit_compile
+    struct jit *jit;
+
+    // where vm_run resumes after an error or a stack fault
+    sigjmp_buf *trap;
+
     bool ready;
     bool finished;
     FILE *in;
     FILE *out;
-    char *curword;
+    // text read from in, the whole file when it could be mapped and
+    // otherwise a window over it, see vm_refill
+    char *src;
+    size_t srclen;
+    size_t srccap;
+    size_t srcpos;
+    // start of the token being read, kept by a refill
+    size_t srcmark;
+    bool srcmapped;
+    // the last word read, in place in src until the next token
+    const char *curword;
+    int curlen;
+    uint32_t curhash;
     char *errmsg;
 };
 
@@ -68,14 +264,31 @@ void vm_push_rs(struct forthvm *vm, data d);
 data vm_read_word(struct forthvm *vm);
 void vm_emit_data(struct forthvm *vm, data d);
 void vm_emit_opcode(struct forthvm *vm, enum opcode);
+void vm_emit_call(struct forthvm *vm, enum opcode op, data entry);
+void vm_define(struct forthvm *vm, data entry, data addr);
+void vm_mark_label(struct forthvm *vm);
+data vm_skip_begin(struct forthvm *vm);
+void vm_skip_end(struct forthvm *vm, data over);
+void vm_reserve_halt(struct forthvm *vm);
+void vm_call(struct forthvm *vm, data entry);
+void vm_call_at(struct forthvm *vm, data addr);
+_Noreturn void vm_halt(struct forthvm *vm, int ret);
+_Noreturn void vm_error(struct forthvm *vm, char *msg);
+int vm_decode(struct forthvm *vm, data cell);
 void vm_heapsz(struct forthvm *vm, data size);
+int vm_stacksz(struct forthvm *vm, data dssz, data rssz);
 void vm_heap_grow(struct forthvm *vm, data size);
-char vm_getc(struct forthvm *vm);
-void vm_ungetc(struct forthvm *vm, char c);
+data vm_allocate(struct forthvm *vm, data size);
+data vm_resize(struct forthvm *vm, data addr, data size);
+void vm_free(struct forthvm *vm, data addr);
+data vm_cfunc_cell(struct forthvm *vm, opfunc f);
+size_t vm_refill(struct forthvm *vm);
+char **vm_word_names(struct forthvm *vm);
 void vm_regfunc(struct forthvm *vm, char *word, opfunc f);
 
 data vm_execute(struct forthvm *vm);
 void vm_init(struct forthvm *vm, FILE *fin, FILE *fout);
+int vm_set_engine(struct forthvm *vm, enum engine e);
 void vm_run(struct forthvm *vm);
 
 #endif